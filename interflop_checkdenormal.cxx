@@ -30,10 +30,54 @@
    The GNU Lesser General Public License is contained in the file COPYING.
 */
 
+#include <algorithm>
 #include <argp.h>
 #include <cmath>
+#include <climits>
+#include <cerrno>
+#include <cfloat>
 #include <limits>
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+/* Call sites, streaming, watchpoints, the metrics file and selective flush */
+/* use libc beyond interflop_stdlib, configure --disable-libc drops them */
+#ifndef IFCD_USE_LIBC
+#define IFCD_USE_LIBC 1
+#endif
+
+#if IFCD_USE_LIBC
+#include <csignal>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#else
+/* Call sites are not resolved without libc */
+typedef struct {
+  const char *dli_fname;
+  void *dli_fbase;
+  const char *dli_sname;
+  void *dli_saddr;
+} Dl_info;
+static inline int dladdr(const void *, Dl_info *) { return 0; }
+#endif
+#if IFCD_USE_LIBC && defined(__linux__)
+#include <dirent.h>
+#include <linux/hw_breakpoint.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define IFCD_HAS_WATCH 1
+#else
+#define IFCD_HAS_WATCH 0
+#endif
 
 #include "interflop/fma/interflop_fma.h"
 #include "interflop/interflop.h"
@@ -41,126 +85,3306 @@
 #include "interflop/iostream/logger.h"
 #include "interflop_checkdenormal.h"
 
-// * Global variables & parameters
+// * Global variables & parameters
+
+static const char backend_name[] = "interflop-checkdenormal";
+static const char backend_version[] = "1.x-dev";
+
+typedef enum {
+  KEY_FTZ,
+  KEY_LATENCY_SAMPLING,
+  KEY_SITE_DEPTH,
+  KEY_REPORT_FILE,
+  KEY_RESCALE_SAMPLING,
+  KEY_EXTENDED_SHADOW,
+  KEY_FUNCTION_BOUNDARIES,
+  KEY_CALLING_CONTEXT,
+  KEY_HEATMAP,
+  KEY_HEATMAP_WINDOW,
+  KEY_METRICS,
+  KEY_METRICS_INTERVAL,
+  KEY_STREAM,
+  KEY_RECORD,
+  KEY_FLUSH_SITES,
+  KEY_ALERT,
+  KEY_WATCH,
+  KEY_WATCH_INTERVAL
+} key_args;
+
+static const char key_ftz_str[] = "flush-to-zero";
+static const char key_latency_sampling_str[] = "latency-sampling";
+static const char key_site_depth_str[] = "site-depth";
+static const char key_report_file_str[] = "report-file";
+static const char key_rescale_sampling_str[] = "rescale-sampling";
+static const char key_extended_shadow_str[] = "extended-shadow";
+static const char key_function_boundaries_str[] = "function-boundaries";
+static const char key_calling_context_str[] = "calling-context";
+static const char key_heatmap_str[] = "heatmap";
+static const char key_heatmap_window_str[] = "heatmap-window";
+static const char key_metrics_str[] = "metrics";
+static const char key_metrics_interval_str[] = "metrics-interval";
+static const char key_stream_str[] = "stream";
+static const char key_record_str[] = "record";
+static const char key_flush_sites_str[] = "flush-sites";
+static const char key_alert_str[] = "alert";
+static const char key_watch_str[] = "watch";
+static const char key_watch_interval_str[] = "watch-interval";
+
+static File *stderr_stream;
+
+/* Operations and types tracked by the backend */
+typedef enum {
+  IFCD_OP_ADD,
+  IFCD_OP_SUB,
+  IFCD_OP_MUL,
+  IFCD_OP_DIV,
+  IFCD_OP_FMA,
+  IFCD_OP_CAST,
+  IFCD_OP_END
+} ifcd_op_t;
+
+typedef enum { IFCD_FLOAT, IFCD_DOUBLE, IFCD_TYPE_END } ifcd_type_t;
+
+static const char *ifcd_op_name[IFCD_OP_END] = {"add", "sub", "mul",
+                                                 "div", "fma", "cast"};
+static const char *ifcd_type_name[IFCD_TYPE_END] = {"float", "double"};
+
+static const char *ifcd_alert_action_name[] = {"log", "report", "trap",
+                                               "handler"};
+
+/* Latency classes: all operands and result normal, or one of them denormal */
+typedef enum { IFCD_NORMAL, IFCD_DENORMAL, IFCD_CLASS_END } ifcd_class_t;
+
+static const char *ifcd_class_name[IFCD_CLASS_END] = {"normal", "denormal"};
+
+/* Outcome of re-evaluating a denormal or underflowed double operation with */
+/* the exponent range of long double */
+typedef enum {
+  /* normal with a wider exponent range: rescaling fixes it */
+  IFCD_SHADOW_RANGE,
+  /* still subnormal: the exact result is genuinely tiny */
+  IFCD_SHADOW_TINY,
+  /* exactly zero: the exact result is genuinely zero */
+  IFCD_SHADOW_ZERO,
+  IFCD_SHADOW_END
+} ifcd_shadow_t;
+
+static const char *ifcd_shadow_name[IFCD_SHADOW_END] = {"range", "tiny",
+                                                         "zero"};
+
+/* Bucket k counts latencies in [2^(k-1), 2^k) cycles */
+#define IFCD_LATENCY_BUCKETS 32
+/* Number of distinct call sites tracked per thread (power of two) */
+#define IFCD_SITE_TABLE_SIZE 1024
+/* Default --site-depth, skipping the Verificarlo wrapper */
+#define IFCD_SITE_DEPTH 2
+/* Deepest call site accepted by --site-depth */
+#define IFCD_MAX_SITE_DEPTH 16
+
+/* Exponents tracked below the smallest normal exponent for rescaling */
+#define IFCD_RESCALE_WINDOW 128
+/* Bin 0: below the window, bins 1..WINDOW: subnormal range and underflows */
+/* to zero, last bin: normal values */
+#define IFCD_RESCALE_BINS (IFCD_RESCALE_WINDOW + 2)
+/* Fraction of values that the recommended scale moves out of subnormals */
+#define IFCD_RESCALE_QUANTILE 0.01
+
+typedef uint64_t ifcd_histogram_t[IFCD_LATENCY_BUCKETS];
+
+typedef struct ifcd_site {
+  void *addr;
+  ifcd_histogram_t latency[IFCD_CLASS_END];
+  /* exponents relative to the smallest normal exponent of their type */
+  uint64_t exponents[IFCD_RESCALE_BINS];
+  /* smallest distance between an exponent and the largest finite one */
+  int headroom;
+  uint64_t shadow[IFCD_SHADOW_END];
+} ifcd_site_t;
+
+/* Number of distinct instrumented functions tracked per thread */
+#define IFCD_FUNCTION_TABLE_SIZE 1024
+/* Argument positions tracked, later ones are counted in the last position */
+#define IFCD_MAX_ARGS 16
+
+/* Values seen when entering (arguments) and exiting (return values) */
+typedef enum { IFCD_ARG_IN, IFCD_ARG_OUT, IFCD_DIRECTION_END } ifcd_direction_t;
+
+static const char *ifcd_direction_name[IFCD_DIRECTION_END] = {"arg", "ret"};
+
+typedef struct ifcd_arg {
+  uint64_t checked;
+  uint64_t denormal;
+} ifcd_arg_t;
+
+typedef struct ifcd_boundary {
+  interflop_function_info_t *info;
+  uint64_t calls;
+  ifcd_arg_t args[IFCD_DIRECTION_END][IFCD_MAX_ARGS];
+} ifcd_boundary_t;
+
+typedef struct ifcd_boundary_table {
+  ifcd_boundary_t functions[IFCD_FUNCTION_TABLE_SIZE];
+  /* calls not recorded because the table was full */
+  uint64_t dropped;
+} ifcd_boundary_table_t;
+
+/* Sites whose operands are recorded per thread (power of two) */
+#define IFCD_RECORD_SITES 256
+/* Operands kept per site by reservoir sampling */
+#define IFCD_RECORD_SAMPLES 64
+
+typedef struct ifcd_operands {
+  uint8_t op;
+  uint8_t type;
+  double a;
+  double b;
+  double c;
+} ifcd_operands_t;
+
+typedef struct ifcd_record_site {
+  void *addr;
+  /* operations recorded at this site, samples are a uniform subset */
+  uint64_t seen;
+  ifcd_operands_t samples[IFCD_RECORD_SAMPLES];
+} ifcd_record_site_t;
+
+typedef struct ifcd_record_table {
+  ifcd_record_site_t sites[IFCD_RECORD_SITES];
+  /* operations not recorded because the table was full */
+  uint64_t dropped;
+} ifcd_record_table_t;
+
+/* Calling contexts tracked per thread (power of two) */
+#define IFCD_CONTEXT_TABLE_SIZE 1024
+/* Deepest function nesting with its own context, deeper calls share the */
+/* context of their ancestor at this depth */
+#define IFCD_CONTEXT_DEPTH 256
+/* Frames of the representative stack of a context */
+#define IFCD_CONTEXT_FRAMES 16
+
+typedef struct ifcd_context {
+  void *site;
+  uint64_t hash;
+  uint64_t denormals;
+  /* stack of the first event in this context, frames[0] is the site */
+  int nb_frames;
+  void *frames[IFCD_CONTEXT_FRAMES];
+} ifcd_context_t;
+
+typedef struct ifcd_context_table {
+  ifcd_context_t contexts[IFCD_CONTEXT_TABLE_SIZE];
+  /* events not recorded because the table was full */
+  uint64_t dropped;
+} ifcd_context_table_t;
+
+/* Operations between two checks of the metrics deadline and of the alert */
+/* windows by a thread */
+#define IFCD_CHECK_PERIOD 4096
+/* Default metrics update period, in seconds */
+#define IFCD_METRICS_INTERVAL_S 10
+
+/* Counters of a thread at the start of the current window of an alert */
+typedef struct ifcd_alert_window {
+  uint64_t start_ns;
+  uint64_t operations;
+  uint64_t denormals;
+  /* the previous window exceeded the threshold */
+  bool firing;
+} ifcd_alert_window_t;
+
+/* Events buffered per thread for the stream writer (power of two) */
+#define IFCD_STREAM_RING_SIZE 4096
+/* Records sent per batch */
+#define IFCD_STREAM_BATCH 1024
+/* Pause of the stream writer when every ring is empty, in milliseconds */
+#define IFCD_STREAM_POLL_MS 10
+/* Delay before reconnecting to the collector, in milliseconds */
+#define IFCD_STREAM_RETRY_MS 1000
+/* Time given at finalize to deliver the buffered events, in milliseconds */
+#define IFCD_STREAM_FINISH_MS 1000
+/* Sites whose module and offset are cached by the writer (power of two) */
+#define IFCD_STREAM_SITE_CACHE 256
+
+typedef struct ifcd_stream_event {
+  uint64_t time_ns;
+  void *site;
+  uint64_t context;
+  double value;
+  uint8_t op;
+  uint8_t type;
+  /* thread of the event, its ring may be reused by a later thread */
+  int tid;
+} ifcd_stream_event_t;
+
+/* Single-producer single-consumer ring between a thread and the writer */
+typedef struct ifcd_stream_ring {
+  uint64_t head;
+  uint64_t tail;
+  ifcd_stream_event_t events[IFCD_STREAM_RING_SIZE];
+} ifcd_stream_ring_t;
+
+/* Buffers that can be registered for watching at the same time */
+#define IFCD_WATCH_BUFFERS 16
+/* Captures of unregistered buffers kept for the report */
+#define IFCD_WATCH_REPORTS 256
+/* Maximum writers captured per buffer */
+#define IFCD_WATCH_CAPTURES 16
+/* Threads receiving the breakpoint of an armed buffer */
+#define IFCD_WATCH_THREADS 256
+/* Frames of the stack captured with a writer */
+#define IFCD_WATCH_FRAMES 16
+/* Data pages of the sample ring of a breakpoint (power of two) */
+#define IFCD_WATCH_RING_PAGES 1
+/* Scans after which a breakpoint without hit is moved to the threads and */
+/* the denormal found by a new scan */
+#define IFCD_WATCH_REFRESH 10
+/* Default scan period, in milliseconds */
+#define IFCD_WATCH_INTERVAL_MS 100
+
+typedef struct ifcd_watch_capture {
+  size_t index;
+  /* value at index when the sample was read */
+  double value;
+  int tid;
+  int nb_frames;
+  /* frames[0] is the instruction following the write */
+  void *frames[IFCD_WATCH_FRAMES];
+} ifcd_watch_capture_t;
+
+typedef struct ifcd_watch_buffer {
+  char name[64];
+  void *addr;
+  size_t count;
+  ifcd_type_t type;
+  /* index of the watched value, -1 when no breakpoint is armed */
+  long armed;
+  unsigned int armed_scans;
+  /* index where the next scan starts, after the last watched value */
+  size_t next_scan;
+  /* a failure to arm was already reported */
+  bool warned;
+  int nb_events;
+  int fds[IFCD_WATCH_THREADS];
+  void *rings[IFCD_WATCH_THREADS];
+  unsigned int nb_captures;
+  ifcd_watch_capture_t captures[IFCD_WATCH_CAPTURES];
+} ifcd_watch_buffer_t;
+
+/* Writer captured in a buffer that was unregistered since */
+typedef struct ifcd_watch_report {
+  char name[64];
+  ifcd_watch_capture_t capture;
+} ifcd_watch_report_t;
+
+/* Call sites whose --flush-sites decision is cached per thread */
+#define IFCD_FLUSH_CACHE 256
+
+/* Site flushed with --flush-sites, identified as in the event stream */
+typedef struct ifcd_flush_site {
+  uint32_t module;
+  uint64_t offset;
+} ifcd_flush_site_t;
+
+typedef struct ifcd_flush_entry {
+  void *site;
+  bool flush;
+} ifcd_flush_entry_t;
+
+/* Sites with their own heatmap row per thread, later ones share a row */
+#define IFCD_HEATMAP_ROWS 64
+/* Time windows per row, adjacent windows are merged once they are full */
+#define IFCD_HEATMAP_WINDOWS 256
+/* Sites written to the heatmap, the others are summed in an "other" row */
+#define IFCD_HEATMAP_TOP 32
+/* Default initial time window, in milliseconds */
+#define IFCD_HEATMAP_WINDOW_MS 100
+
+typedef struct ifcd_heatmap {
+  /* site of each row, the last row counts every other site */
+  void *sites[IFCD_HEATMAP_ROWS];
+  uint64_t events[IFCD_HEATMAP_ROWS + 1][IFCD_HEATMAP_WINDOWS];
+  /* windows last heatmap_window << scale milliseconds */
+  unsigned int scale;
+} ifcd_heatmap_t;
+
+typedef struct ifcd_site_table {
+  ifcd_site_t sites[IFCD_SITE_TABLE_SIZE];
+  /* sites not recorded because the table was full */
+  uint64_t dropped;
+} ifcd_site_table_t;
+
+/* Per-thread state, only written by its owner and merged at finalize */
+typedef enum {
+  IFCD_SAMPLER_LATENCY,
+  IFCD_SAMPLER_RESCALE,
+  IFCD_SAMPLER_END
+} ifcd_sampler_t;
+
+typedef struct ifcd_thread {
+  struct ifcd_thread *next;
+  /* cleared when the owner exits, the state is then reused with its */
+  /* counters by the next thread claiming it */
+  bool owned;
+  uint64_t sample_countdown[IFCD_SAMPLER_END];
+  /* xorshift state for the sampling period */
+  uint64_t rng;
+  ifcd_histogram_t latency[IFCD_OP_END][IFCD_TYPE_END][IFCD_CLASS_END];
+  uint64_t shadow[IFCD_OP_END][IFCD_SHADOW_END];
+  ifcd_site_table_t site_table;
+  ifcd_boundary_table_t boundary_table;
+  ifcd_context_table_t context_table;
+  /* allocated on the first recorded operation */
+  ifcd_record_table_t *record_table;
+  /* hash of the functions entered at each depth of the frontend stack */
+  uint64_t context_hashes[IFCD_CONTEXT_DEPTH + 1];
+  uint64_t context_hash;
+  ifcd_heatmap_t heatmap;
+  /* counters read by other threads for the metrics, see ifcd_counter_add */
+  uint64_t operations[IFCD_OP_END][IFCD_TYPE_END];
+  uint64_t denormals[IFCD_OP_END][IFCD_TYPE_END];
+  uint64_t flushes;
+  uint64_t overhead_ns;
+  uint64_t alerts;
+  uint64_t check_countdown;
+  ifcd_alert_window_t alert_windows[CHECKDENORMAL_MAX_ALERTS];
+  int tid;
+  ifcd_stream_ring_t stream_ring;
+  /* events dropped because the ring was full */
+  uint64_t stream_dropped;
+  ifcd_flush_entry_t flush_cache[IFCD_FLUSH_CACHE];
+} ifcd_thread_t;
+
+/* List of every thread state, never freed so that other threads can walk */
+/* it without locking */
+static ifcd_thread_t *ifcd_threads = Null;
+#if IFCD_USE_LIBC
+/* Releases the state of an exiting thread */
+static pthread_key_t ifcd_thread_key;
+static pthread_once_t ifcd_thread_key_once = PTHREAD_ONCE_INIT;
+#endif
+/* Time origin of the heatmap, in nanoseconds */
+static uint64_t ifcd_start_ns;
+/* Time of the next periodic metrics file update, in nanoseconds */
+static uint64_t ifcd_metrics_deadline_ns;
+/* Set while a thread writes the metrics file */
+static bool ifcd_metrics_writing = false;
+/* Report snapshots written by alerts */
+static unsigned int ifcd_alert_snapshots = 0;
+#if IFCD_USE_LIBC
+/* Background thread sending events to the collector */
+static pthread_t ifcd_stream_thread;
+static bool ifcd_stream_stop = false;
+#endif
+/* events drained by the writer but not delivered to the collector */
+static uint64_t ifcd_stream_lost = 0;
+#if IFCD_HAS_WATCH
+static ifcd_watch_buffer_t ifcd_watch_buffers[IFCD_WATCH_BUFFERS];
+static int ifcd_nb_watch_buffers = 0;
+/* Captures moved out of the slots of unregistered buffers */
+static ifcd_watch_report_t ifcd_watch_reports[IFCD_WATCH_REPORTS];
+static int ifcd_nb_watch_reports = 0;
+static uint64_t ifcd_watch_reports_dropped = 0;
+/* Protects the watched buffers against the watcher thread */
+static pthread_mutex_t ifcd_watch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t ifcd_watch_thread;
+static bool ifcd_watch_stop = false;
+#endif
+/* Sites of --flush-sites sorted by module and offset */
+static ifcd_flush_site_t *ifcd_flush_sites = Null;
+static size_t ifcd_nb_flush_sites = 0;
+static __thread ifcd_thread_t *ifcd_current_thread = Null;
+
+template <typename REAL>
+void ifcd_checkdenorm(const REAL &a, const REAL &b, const REAL &r);
+
+template <typename REAL> static inline bool ifcd_is_denormal(REAL x) {
+  return std::fpclassify(x) == FP_SUBNORMAL;
+}
+
+template <typename REAL> static inline ifcd_type_t ifcd_type() {
+  return (sizeof(REAL) == sizeof(double)) ? IFCD_DOUBLE : IFCD_FLOAT;
+}
+
+/* Type of the operands of OP, given the type of its result */
+template <ifcd_op_t OP, typename REAL>
+static inline ifcd_type_t ifcd_op_type() {
+  return (OP == IFCD_OP_CAST) ? IFCD_DOUBLE : ifcd_type<REAL>();
+}
+
+/* Per-thread state is only written by its owner but read concurrently by  */
+/* the metrics and stream writers and by finalize: counters are updated by */
+/* the owner with relaxed atomic stores, which compile to plain moves, and */
+/* table keys are published with release stores. */
+
+/* Owner-only update of a counter that other threads may read concurrently */
+static inline void ifcd_counter_add(uint64_t *counter, uint64_t value) {
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value,
+                   __ATOMIC_RELAXED);
+}
+
+static inline uint64_t ifcd_counter_read(const uint64_t *counter) {
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/* Wall clock time, the options reading it require interflop_gettimeofday */
+static inline uint64_t ifcd_now_ns(void) {
+  struct timeval tv;
+  interflop_gettimeofday(&tv, Null);
+  return (uint64_t)tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+}
+
+#if IFCD_USE_LIBC
+/* Hand the state of an exiting thread over to the next new thread. Its */
+/* counters stay in the merged totals and memory is bounded by the */
+/* largest number of live threads. */
+static void ifcd_thread_release(void *state) {
+  ifcd_thread_t *th = (ifcd_thread_t *)state;
+  /* Operations in later destructors claim a state again */
+  ifcd_current_thread = Null;
+  __atomic_store_n(&th->owned, false, __ATOMIC_RELEASE);
+}
+
+static void ifcd_thread_key_create(void) {
+  if (pthread_key_create(&ifcd_thread_key, ifcd_thread_release) != 0) {
+    logger_error("cannot create the per-thread state key\n");
+  }
+}
+
+/* Claim the state released by an exited thread, Null if there is none */
+static ifcd_thread_t *ifcd_thread_claim(void) {
+  for (ifcd_thread_t *th = __atomic_load_n(&ifcd_threads, __ATOMIC_ACQUIRE);
+       th != Null; th = th->next) {
+    bool owned = false;
+    if (!__atomic_load_n(&th->owned, __ATOMIC_RELAXED) &&
+        __atomic_compare_exchange_n(&th->owned, &owned, true, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      th->context_hash = 0;
+      /* the alert windows of the new owner start at its first operation */
+      th->check_countdown = 0;
+      for (unsigned int i = 0; i < CHECKDENORMAL_MAX_ALERTS; i++) {
+        th->alert_windows[i].start_ns = 0;
+      }
+      return th;
+    }
+  }
+  return Null;
+}
+#endif
+
+static ifcd_thread_t *ifcd_thread_alloc(void) {
+#if IFCD_USE_LIBC
+  pthread_once(&ifcd_thread_key_once, ifcd_thread_key_create);
+  ifcd_thread_t *th = ifcd_thread_claim();
+#else
+  /* Without thread exit notifications states are never reused */
+  ifcd_thread_t *th = Null;
+#endif
+  if (th == Null) {
+    th = (ifcd_thread_t *)interflop_calloc(1, sizeof(ifcd_thread_t));
+    if (th == Null) {
+      logger_error("cannot allocate per-thread state\n");
+    }
+    th->owned = true;
+    th->rng = 0x9E3779B97F4A7C15ULL ^ (uintptr_t)th;
+    th->next = __atomic_load_n(&ifcd_threads, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&ifcd_threads, &th->next, th, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+  }
+  th->tid = (interflop_gettid != Null) ? interflop_gettid() : 0;
+#if IFCD_USE_LIBC
+  pthread_setspecific(ifcd_thread_key, th);
+#endif
+  return th;
+}
+
+static inline ifcd_thread_t *ifcd_thread(void) {
+  if (__builtin_expect(ifcd_current_thread == Null, 0)) {
+    ifcd_current_thread = ifcd_thread_alloc();
+  }
+  return ifcd_current_thread;
+}
+
+static inline uint64_t ifcd_hash_ptr(const void *addr) {
+  return ((uintptr_t)addr >> 2) * 0x9E3779B97F4A7C15ULL;
+}
+
+/* Return the site_table entry for addr, Null if the table is full */
+static ifcd_site_t *ifcd_site_lookup(ifcd_site_table_t *table, void *addr) {
+  uint64_t h = ifcd_hash_ptr(addr);
+  for (unsigned int i = 0; i < IFCD_SITE_TABLE_SIZE; i++) {
+    ifcd_site_t *site =
+        &table->sites[(h + i) & (IFCD_SITE_TABLE_SIZE - 1)];
+    if (site->addr == addr) {
+      return site;
+    }
+    if (site->addr == Null) {
+      __atomic_store_n(&site->headroom, INT_MAX, __ATOMIC_RELAXED);
+      __atomic_store_n(&site->addr, addr, __ATOMIC_RELEASE);
+      return site;
+    }
+  }
+  ifcd_counter_add(&table->dropped, 1);
+  return Null;
+}
+
+/* Return the boundary_table entry for info, Null if the table is full */
+static ifcd_boundary_t *ifcd_boundary_lookup(ifcd_boundary_table_t *table,
+                                             interflop_function_info_t *info) {
+  uint64_t h = ifcd_hash_ptr(info);
+  for (unsigned int i = 0; i < IFCD_FUNCTION_TABLE_SIZE; i++) {
+    ifcd_boundary_t *function =
+        &table->functions[(h + i) & (IFCD_FUNCTION_TABLE_SIZE - 1)];
+    if (function->info == info) {
+      return function;
+    }
+    if (function->info == Null) {
+      __atomic_store_n(&function->info, info, __ATOMIC_RELEASE);
+      return function;
+    }
+  }
+  ifcd_counter_add(&table->dropped, 1);
+  return Null;
+}
+
+/* Return the context_table entry for site in the calling context hash, */
+/* an entry whose site is Null if it is new, or Null if the table is full */
+static ifcd_context_t *ifcd_context_lookup(ifcd_context_table_t *table,
+                                           void *site, uint64_t hash) {
+  uint64_t h = ifcd_hash_ptr(site) ^ hash;
+  for (unsigned int i = 0; i < IFCD_CONTEXT_TABLE_SIZE; i++) {
+    ifcd_context_t *context =
+        &table->contexts[(h + i) & (IFCD_CONTEXT_TABLE_SIZE - 1)];
+    if (context->site == Null ||
+        (context->site == site && context->hash == hash)) {
+      return context;
+    }
+  }
+  ifcd_counter_add(&table->dropped, 1);
+  return Null;
+}
+
+/* Return the address of the instruction that requested the operation, */
+/* depth frames above the backend entry point. Callers must be inlined */
+/* into the entry point for the frame count to hold. */
+static __attribute__((noinline)) void *ifcd_get_site(unsigned int depth) {
+#if IFCD_USE_LIBC
+  void *frames[IFCD_MAX_SITE_DEPTH + 2];
+  int size = backtrace(frames, depth + 2);
+  return (size == (int)depth + 2) ? frames[depth + 1] : Null;
+#else
+  (void)depth;
+  return Null;
+#endif
+}
+
+/* Call site of the operation being checked, unwound at most once by the */
+/* first feature that needs it */
+typedef struct ifcd_op_site {
+  void *addr;
+  bool resolved;
+} ifcd_op_site_t;
+
+static inline __attribute__((always_inline)) void *
+ifcd_op_site_addr(ifcd_op_site_t *op_site, checkdenormal_context_t *ctx) {
+  if (!op_site->resolved) {
+#if IFCD_USE_LIBC
+    /* the return address of the entry point needs no unwinding */
+    op_site->addr = (ctx->site_depth == 1) ? __builtin_return_address(0)
+                                           : ifcd_get_site(ctx->site_depth);
+#else
+    op_site->addr = ifcd_get_site(ctx->site_depth);
+#endif
+    op_site->resolved = true;
+  }
+  return op_site->addr;
+}
+
+/* Store the stack from the call site, with the same depth as ifcd_get_site */
+static __attribute__((noinline)) int ifcd_get_stack(void **frames,
+                                                    unsigned int depth) {
+#if IFCD_USE_LIBC
+  void *all[IFCD_MAX_SITE_DEPTH + 1 + IFCD_CONTEXT_FRAMES];
+  int size = backtrace(all, depth + 1 + IFCD_CONTEXT_FRAMES);
+  int nb_frames = 0;
+  for (int i = depth + 1; i < size; i++) {
+    frames[nb_frames++] = all[i];
+  }
+  return nb_frames;
+#else
+  (void)frames;
+  (void)depth;
+  return 0;
+#endif
+}
+
+// * Latency measurement
+
+#if defined(__x86_64__)
+/* Serializing timestamps: lfence keeps earlier instructions out of the */
+/* timed region, rdtscp waits for the timed instructions to retire. */
+static inline uint64_t ifcd_cycles_begin(void) {
+  uint32_t lo, hi;
+  __asm__ __volatile__("lfence\n\trdtsc" : "=a"(lo), "=d"(hi)::"memory");
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t ifcd_cycles_end(void) {
+  uint32_t lo, hi;
+  __asm__ __volatile__("rdtscp\n\tlfence"
+                       : "=a"(lo), "=d"(hi)::"rcx", "memory");
+  return ((uint64_t)hi << 32) | lo;
+}
+
+/* Pin x between the timestamps */
+template <typename REAL> static inline void ifcd_barrier(REAL &x) {
+  __asm__ __volatile__("" : "+x"(x));
+}
+#define IFCD_HAS_CYCLES 1
+#else
+#define IFCD_HAS_CYCLES 0
+#endif
+
+template <ifcd_op_t OP, typename IN, typename OUT = IN>
+static inline __attribute__((always_inline)) OUT ifcd_native(IN a, IN b,
+                                                            IN c) {
+  switch (OP) {
+  case IFCD_OP_ADD:
+    return a + b;
+  case IFCD_OP_SUB:
+    return a - b;
+  case IFCD_OP_MUL:
+    return a * b;
+  case IFCD_OP_DIV:
+    return a / b;
+  case IFCD_OP_FMA:
+    if (sizeof(IN) == sizeof(double)) {
+      return interflop_fma_binary64(a, b, c);
+    } else {
+      return interflop_fma_binary32(a, b, c);
+    }
+  case IFCD_OP_CAST:
+  default:
+    return (OUT)a;
+  }
+}
+
+static inline unsigned int ifcd_latency_bucket(uint64_t cycles) {
+  unsigned int bucket = (cycles == 0) ? 0 : 64 - __builtin_clzll(cycles);
+  return (bucket < IFCD_LATENCY_BUCKETS) ? bucket : IFCD_LATENCY_BUCKETS - 1;
+}
+
+/* Return true for 1 call out of period on average */
+/* xorshift64 */
+static inline uint64_t ifcd_random(ifcd_thread_t *th) {
+  th->rng ^= th->rng << 13;
+  th->rng ^= th->rng >> 7;
+  th->rng ^= th->rng << 17;
+  return th->rng;
+}
+
+static inline bool ifcd_sampled(ifcd_thread_t *th, ifcd_sampler_t sampler,
+                                unsigned int period) {
+  if (period == 1) {
+    return true;
+  }
+  if (th->sample_countdown[sampler] > 1) {
+    th->sample_countdown[sampler]--;
+    return false;
+  }
+  /* Randomize the period so that sampling does not alias with loops */
+  th->sample_countdown[sampler] = 1 + ifcd_random(th) % (2 * (uint64_t)period);
+  return true;
+}
+
+/* Time the native operation and record it for its type and call site */
+template <ifcd_op_t OP, typename IN, typename OUT = IN>
+static inline __attribute__((always_inline)) OUT
+ifcd_timed_op(IN a, IN b, IN c, checkdenormal_context_t *ctx,
+              ifcd_thread_t *th, ifcd_op_site_t *op_site) {
+#if IFCD_HAS_CYCLES
+  uint64_t start = ifcd_cycles_begin();
+  ifcd_barrier(a);
+  ifcd_barrier(b);
+  ifcd_barrier(c);
+  OUT r = ifcd_native<OP, IN, OUT>(a, b, c);
+  ifcd_barrier(r);
+  uint64_t cycles = ifcd_cycles_end() - start;
+
+  ifcd_class_t cls = (ifcd_is_denormal(a) || ifcd_is_denormal(b) ||
+                      ifcd_is_denormal(c) || ifcd_is_denormal(r))
+                         ? IFCD_DENORMAL
+                         : IFCD_NORMAL;
+  unsigned int bucket = ifcd_latency_bucket(cycles);
+  ifcd_counter_add(&th->latency[OP][ifcd_type<IN>()][cls][bucket], 1);
+  ifcd_site_t *site = ifcd_site_lookup(&th->site_table,
+                                       ifcd_op_site_addr(op_site, ctx));
+  if (site != Null) {
+    ifcd_counter_add(&site->latency[cls][bucket], 1);
+  }
+  return r;
+#else
+  return ifcd_native<OP, IN, OUT>(a, b, c);
+#endif
+}
+
+/* Perform the native operation, timing a sample of them if requested */
+template <ifcd_op_t OP, typename IN, typename OUT = IN>
+static inline __attribute__((always_inline)) OUT
+ifcd_doop(IN a, IN b, IN c, checkdenormal_context_t *ctx,
+          ifcd_op_site_t *op_site) {
+  if (ctx->latency_sampling != 0) {
+    ifcd_thread_t *th = ifcd_thread();
+    if (ifcd_sampled(th, IFCD_SAMPLER_LATENCY, ctx->latency_sampling)) {
+      return ifcd_timed_op<OP, IN, OUT>(a, b, c, ctx, th, op_site);
+    }
+  }
+  return ifcd_native<OP, IN, OUT>(a, b, c);
+}
+
+// * Exponent profiling
+
+template <typename REAL> static inline int ifcd_min_exponent() {
+  return std::numeric_limits<REAL>::min_exponent - 1;
+}
+
+template <typename REAL> static inline int ifcd_max_exponent() {
+  return std::numeric_limits<REAL>::max_exponent - 1;
+}
+
+/* Record exponent, that would have belonged to a value of type REAL */
+template <typename REAL>
+static inline void ifcd_rescale_record(ifcd_site_t *site, int exponent) {
+  int delta = exponent - ifcd_min_exponent<REAL>();
+  int bin = (delta >= 0)                     ? IFCD_RESCALE_BINS - 1
+            : (delta < -IFCD_RESCALE_WINDOW) ? 0
+                                             : delta + IFCD_RESCALE_WINDOW + 1;
+  ifcd_counter_add(&site->exponents[bin], 1);
+  if (ifcd_max_exponent<REAL>() - exponent < site->headroom) {
+    __atomic_store_n(&site->headroom, ifcd_max_exponent<REAL>() - exponent,
+                     __ATOMIC_RELAXED);
+  }
+}
+
+template <typename REAL>
+static inline void ifcd_rescale_value(ifcd_site_t *site, REAL x) {
+  if (x != 0 && std::isfinite(x)) {
+    ifcd_rescale_record<REAL>(site, std::ilogb(x));
+  }
+}
+
+/* Exponent of the exact result of an operation that underflowed to zero, */
+/* INT_MIN if it cannot be told from the operands */
+template <ifcd_op_t OP, typename IN>
+static inline int ifcd_underflow_exponent(IN a, IN b) {
+  if (a == 0 || !std::isfinite(a) || b == 0 || !std::isfinite(b)) {
+    return INT_MIN;
+  }
+  switch (OP) {
+  case IFCD_OP_MUL:
+    return std::ilogb(a) + std::ilogb(b);
+  case IFCD_OP_DIV:
+    return std::ilogb(a) - std::ilogb(b);
+  case IFCD_OP_CAST:
+    return std::ilogb(a);
+  default:
+    return INT_MIN;
+  }
+}
+
+/* Record the operand and result exponents of a sample of operations */
+template <ifcd_op_t OP, typename IN, typename OUT = IN>
+static inline __attribute__((always_inline)) void
+ifcd_profile(IN a, IN b, IN c, OUT r, checkdenormal_context_t *ctx,
+             ifcd_op_site_t *op_site) {
+  if (ctx->rescale_sampling == 0) {
+    return;
+  }
+  ifcd_thread_t *th = ifcd_thread();
+  if (!ifcd_sampled(th, IFCD_SAMPLER_RESCALE, ctx->rescale_sampling)) {
+    return;
+  }
+  ifcd_site_t *site =
+      ifcd_site_lookup(&th->site_table, ifcd_op_site_addr(op_site, ctx));
+  if (site == Null) {
+    return;
+  }
+  if (OP != IFCD_OP_CAST) {
+    ifcd_rescale_value(site, a);
+    ifcd_rescale_value(site, b);
+  }
+  if (OP == IFCD_OP_FMA) {
+    ifcd_rescale_value(site, c);
+  }
+  if (r == 0) {
+    int exponent =
+        ifcd_underflow_exponent<OP>(a, (OP == IFCD_OP_CAST) ? (IN)1 : b);
+    if (exponent != INT_MIN) {
+      ifcd_rescale_record<OUT>(site, exponent);
+    }
+  } else {
+    ifcd_rescale_value(site, r);
+  }
+}
+
+// * Extended-exponent shadow evaluation
+
+/* long double must have a wider exponent range than double, as with x87 */
+#define IFCD_HAS_EXTENDED (LDBL_MAX_EXP > DBL_MAX_EXP)
+
+template <ifcd_op_t OP>
+static inline long double ifcd_extended(double a, double b, double c) {
+  long double xa = a, xb = b, xc = c;
+  switch (OP) {
+  case IFCD_OP_ADD:
+    return xa + xb;
+  case IFCD_OP_SUB:
+    return xa - xb;
+  case IFCD_OP_MUL:
+    return xa * xb;
+  case IFCD_OP_DIV:
+    return xa / xb;
+  case IFCD_OP_FMA:
+    return std::fma(xa, xb, xc);
+  case IFCD_OP_CAST:
+  default:
+    return xa;
+  }
+}
+
+/* True if a * b + c is exactly zero. The operands are scaled by powers of */
+/* two so that the fused evaluation cannot underflow. */
+template <typename REAL> static bool ifcd_fma_cancels(REAL a, REAL b, REAL c) {
+  if (sizeof(REAL) == sizeof(float)) {
+    /* the product of two floats is exact in double */
+    return (double)a * b + (double)c == 0;
+  }
+  int ea = std::ilogb(a), eb = std::ilogb(b);
+  return interflop_fma_binary64(std::ldexp(a, -ea), std::ldexp(b, -eb),
+                                std::ldexp(c, -ea - eb)) == 0;
+}
+
+/* True if the result is denormal or underflowed to zero. add and sub are */
+/* exact in the subnormal range, so their zeros are exact cancellations. */
+template <ifcd_op_t OP, typename IN, typename OUT>
+static inline bool ifcd_underflowed(IN a, IN b, IN c, OUT r) {
+  if (r != 0) {
+    return ifcd_is_denormal(r);
+  }
+  switch (OP) {
+  case IFCD_OP_MUL:
+  case IFCD_OP_DIV:
+    return a != 0 && b != 0 && std::isfinite(a) && std::isfinite(b);
+  case IFCD_OP_FMA:
+    return a != 0 && b != 0 && std::isfinite(a) && std::isfinite(b) &&
+           !ifcd_fma_cancels(a, b, c);
+  case IFCD_OP_CAST:
+    return a != 0;
+  default:
+    return false;
+  }
+}
+
+/* Re-evaluate double operations that produced a denormal or underflowed */
+/* with the wider exponent range of long double */
+template <ifcd_op_t OP, typename IN, typename OUT = IN>
+static inline __attribute__((always_inline)) void
+ifcd_shadow(IN a, IN b, IN c, OUT r, checkdenormal_context_t *ctx,
+            ifcd_op_site_t *op_site) {
+  if (!ctx->extended_shadow || sizeof(IN) != sizeof(double) ||
+      __builtin_expect(!ifcd_underflowed<OP>(a, b, c, r), 1)) {
+    return;
+  }
+  long double x = ifcd_extended<OP>(a, b, c);
+  ifcd_shadow_t outcome = IFCD_SHADOW_RANGE;
+  if (x == 0) {
+    outcome = IFCD_SHADOW_ZERO;
+  } else if (std::fabs(x) < LDBL_MIN) {
+    outcome = IFCD_SHADOW_TINY;
+  }
+  ifcd_thread_t *th = ifcd_thread();
+  ifcd_counter_add(&th->shadow[OP][outcome], 1);
+  ifcd_site_t *site =
+      ifcd_site_lookup(&th->site_table, ifcd_op_site_addr(op_site, ctx));
+  if (site != Null) {
+    ifcd_counter_add(&site->shadow[outcome], 1);
+  }
+}
+
+// * Operand recording
+
+/* Return the record_table entry for addr, Null if the table is full */
+static ifcd_record_site_t *ifcd_record_lookup(ifcd_thread_t *th, void *addr) {
+  ifcd_record_table_t *table = th->record_table;
+  if (table == Null) {
+    table = (ifcd_record_table_t *)interflop_calloc(
+        1, sizeof(ifcd_record_table_t));
+    if (table == Null) {
+      logger_error("cannot allocate operand records\n");
+    }
+    __atomic_store_n(&th->record_table, table, __ATOMIC_RELEASE);
+  }
+  uint64_t h = ifcd_hash_ptr(addr);
+  for (unsigned int i = 0; i < IFCD_RECORD_SITES; i++) {
+    ifcd_record_site_t *site =
+        &table->sites[(h + i) & (IFCD_RECORD_SITES - 1)];
+    if (site->addr == addr) {
+      return site;
+    }
+    if (site->addr == Null) {
+      __atomic_store_n(&site->addr, addr, __ATOMIC_RELEASE);
+      return site;
+    }
+  }
+  ifcd_counter_add(&table->dropped, 1);
+  return Null;
+}
+
+/* Keep a uniform sample per site of the operands of operations that take */
+/* a denormal or underflow, whose result depends on the flush policy */
+template <ifcd_op_t OP, typename IN, typename OUT = IN>
+static inline __attribute__((always_inline)) void
+ifcd_record(IN a, IN b, IN c, OUT r, checkdenormal_context_t *ctx,
+            ifcd_op_site_t *op_site) {
+  if (ctx->record == Null) {
+    return;
+  }
+  if (__builtin_expect(!ifcd_is_denormal(a) && !ifcd_is_denormal(b) &&
+                           !ifcd_is_denormal(c) &&
+                           !ifcd_underflowed<OP>(a, b, c, r),
+                       1)) {
+    return;
+  }
+  ifcd_thread_t *th = ifcd_thread();
+  ifcd_record_site_t *site =
+      ifcd_record_lookup(th, ifcd_op_site_addr(op_site, ctx));
+  if (site == Null) {
+    return;
+  }
+  uint64_t seen = site->seen + 1;
+  uint64_t slot =
+      (seen > IFCD_RECORD_SAMPLES) ? ifcd_random(th) % seen : seen - 1;
+  if (slot < IFCD_RECORD_SAMPLES) {
+    /* Relaxed stores, finalize may read a sample of a running thread */
+    ifcd_operands_t *sample = &site->samples[slot];
+    double operands[3] = {(double)a, (double)b, (double)c};
+    __atomic_store_n(&sample->op, (uint8_t)OP, __ATOMIC_RELAXED);
+    __atomic_store_n(&sample->type, (uint8_t)ifcd_op_type<OP, IN>(),
+                     __ATOMIC_RELAXED);
+    __atomic_store(&sample->a, &operands[0], __ATOMIC_RELAXED);
+    __atomic_store(&sample->b, &operands[1], __ATOMIC_RELAXED);
+    __atomic_store(&sample->c, &operands[2], __ATOMIC_RELAXED);
+  }
+  /* counted once the sample is stored */
+  __atomic_store_n(&site->seen, seen, __ATOMIC_RELEASE);
+}
+
+// * Heatmap
+
+/* Merge adjacent windows of every row, doubling the window length */
+static void ifcd_heatmap_coarsen(ifcd_heatmap_t *heatmap) {
+  for (int row = 0; row <= IFCD_HEATMAP_ROWS; row++) {
+    uint64_t *events = heatmap->events[row];
+    for (int w = 0; w < IFCD_HEATMAP_WINDOWS / 2; w++) {
+      __atomic_store_n(&events[w], events[2 * w] + events[2 * w + 1],
+                       __ATOMIC_RELAXED);
+    }
+    for (int w = IFCD_HEATMAP_WINDOWS / 2; w < IFCD_HEATMAP_WINDOWS; w++) {
+      __atomic_store_n(&events[w], 0, __ATOMIC_RELAXED);
+    }
+  }
+  __atomic_store_n(&heatmap->scale, heatmap->scale + 1, __ATOMIC_RELAXED);
+}
+
+static void ifcd_heatmap_record(ifcd_heatmap_t *heatmap, void *site,
+                                uint64_t now, checkdenormal_context_t *ctx) {
+  uint64_t window_ns = (uint64_t)ctx->heatmap_window * 1000000ULL;
+  /* the wall clock may step back */
+  uint64_t window =
+      (now > ifcd_start_ns) ? (now - ifcd_start_ns) / window_ns : 0;
+  while ((window >> heatmap->scale) >= IFCD_HEATMAP_WINDOWS) {
+    ifcd_heatmap_coarsen(heatmap);
+  }
+  /* unknown sites are accounted to the last row */
+  int row = (site != Null) ? 0 : IFCD_HEATMAP_ROWS;
+  while (row < IFCD_HEATMAP_ROWS && heatmap->sites[row] != site &&
+         heatmap->sites[row] != Null) {
+    row++;
+  }
+  if (row < IFCD_HEATMAP_ROWS && heatmap->sites[row] == Null) {
+    __atomic_store_n(&heatmap->sites[row], site, __ATOMIC_RELEASE);
+  }
+  ifcd_counter_add(&heatmap->events[row][window >> heatmap->scale], 1);
+}
+
+// * Streaming
+
+static void ifcd_stream_push(ifcd_thread_t *th, const ifcd_stream_event_t *ev) {
+  ifcd_stream_ring_t *ring = &th->stream_ring;
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  if (head - tail == IFCD_STREAM_RING_SIZE) {
+    ifcd_counter_add(&th->stream_dropped, 1);
+    return;
+  }
+  ring->events[head & (IFCD_STREAM_RING_SIZE - 1)] = *ev;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+typedef struct ifcd_stream_writer {
+  checkdenormal_context_t *ctx;
+  int fd;
+  uint64_t retry_ns;
+  /* bytes of the last batch, of which sent were accepted by the socket */
+  size_t size;
+  size_t sent;
+  checkdenormal_stream_header_t header;
+  checkdenormal_stream_record_t records[IFCD_STREAM_BATCH];
+  /* resolved sites, most events come from a few of them */
+  struct {
+    void *site;
+    uint64_t offset;
+    uint32_t module;
+  } sites[IFCD_STREAM_SITE_CACHE];
+} ifcd_stream_writer_t;
+
+/* FNV-1a hash of the module basename, identical across processes */
+static uint32_t ifcd_module_hash(const char *path) {
+  const char *name = path;
+  for (const char *p = path; *p != '\0'; p++) {
+    if (*p == '/') {
+      name = p + 1;
+    }
+  }
+  uint32_t hash = 2166136261u;
+  for (const char *p = name; *p != '\0'; p++) {
+    hash = (hash ^ (unsigned char)*p) * 16777619u;
+  }
+  return hash;
+}
+
+#if IFCD_USE_LIBC
+static void ifcd_stream_connect(ifcd_stream_writer_t *writer) {
+  uint64_t now = ifcd_now_ns();
+  if (now < writer->retry_ns) {
+    return;
+  }
+  writer->retry_ns = now + IFCD_STREAM_RETRY_MS * 1000000ULL;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (fd < 0) {
+    return;
+  }
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  for (size_t i = 0;
+       i < sizeof(addr.sun_path) - 1 && writer->ctx->stream[i] != '\0'; i++) {
+    addr.sun_path[i] = writer->ctx->stream[i];
+  }
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return;
+  }
+  writer->fd = fd;
+}
+
+/* Send what the socket accepts of the last batch without blocking, return */
+/* whether it is complete. Its records are lost if the connection fails. */
+static bool ifcd_stream_flush(ifcd_stream_writer_t *writer) {
+  const char *data = (const char *)&writer->header;
+  while (writer->sent < writer->size) {
+    ssize_t sent = send(writer->fd, data + writer->sent,
+                        writer->size - writer->sent,
+                        MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return false;
+    }
+    if (sent <= 0) {
+      close(writer->fd);
+      writer->fd = -1;
+      ifcd_counter_add(&ifcd_stream_lost, writer->header.count);
+      writer->size = writer->sent = 0;
+      return true;
+    }
+    writer->sent += sent;
+  }
+  return true;
+}
+
+/* Start sending the header and count records, dropping them if there is */
+/* no collector. The previous batch must be complete. */
+static void ifcd_stream_send(ifcd_stream_writer_t *writer, uint32_t count) {
+  if (writer->fd < 0) {
+    ifcd_stream_connect(writer);
+  }
+  if (writer->fd < 0) {
+    ifcd_counter_add(&ifcd_stream_lost, count);
+    return;
+  }
+  writer->header.count = count;
+  writer->header.dropped = ifcd_counter_read(&ifcd_stream_lost);
+  for (ifcd_thread_t *th = __atomic_load_n(&ifcd_threads, __ATOMIC_ACQUIRE);
+       th != Null; th = th->next) {
+    writer->header.dropped += ifcd_counter_read(&th->stream_dropped);
+  }
+  writer->size = sizeof(writer->header) + count * sizeof(writer->records[0]);
+  writer->sent = 0;
+  ifcd_stream_flush(writer);
+}
+
+/* Move the events of every ring to the collector, return the number sent. */
+/* Events stay in the rings while the collector does not keep up. */
+static uint64_t ifcd_stream_drain(ifcd_stream_writer_t *writer) {
+  if (!ifcd_stream_flush(writer)) {
+    return 0;
+  }
+  uint64_t drained = 0;
+  uint32_t count = 0;
+  for (ifcd_thread_t *th = __atomic_load_n(&ifcd_threads, __ATOMIC_ACQUIRE);
+       th != Null; th = th->next) {
+    ifcd_stream_ring_t *ring = &th->stream_ring;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    for (; tail != head; tail++) {
+      const ifcd_stream_event_t *ev =
+          &ring->events[tail & (IFCD_STREAM_RING_SIZE - 1)];
+      auto *cached = &writer->sites[(ifcd_hash_ptr(ev->site) >> 56) &
+                                    (IFCD_STREAM_SITE_CACHE - 1)];
+      if (cached->site != ev->site || cached->site == Null) {
+        Dl_info info;
+        cached->site = ev->site;
+        cached->offset = (uintptr_t)ev->site;
+        cached->module = 0;
+        if (ev->site != Null && dladdr(ev->site, &info) != 0 &&
+            info.dli_fname != Null) {
+          cached->offset -= (uintptr_t)info.dli_fbase;
+          cached->module = ifcd_module_hash(info.dli_fname);
+        }
+      }
+      checkdenormal_stream_record_t *record = &writer->records[count++];
+      record->time_ns = ev->time_ns;
+      record->offset = cached->offset;
+      record->value = ev->value;
+      record->tid = ev->tid;
+      record->module = cached->module;
+      record->op = ev->op;
+      record->type = ev->type;
+      record->context = (uint32_t)ev->context;
+      if (count == IFCD_STREAM_BATCH) {
+        ifcd_stream_send(writer, count);
+        drained += count;
+        count = 0;
+        if (writer->sent < writer->size) {
+          __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+          return drained;
+        }
+      }
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+  }
+  if (count != 0) {
+    ifcd_stream_send(writer, count);
+  }
+  return drained + count;
+}
+
+/* Count the events that could not be delivered before exit as dropped */
+static void ifcd_stream_discard(ifcd_stream_writer_t *writer) {
+  if (writer->sent < writer->size) {
+    /* the collector sees the connection end within the batch */
+    close(writer->fd);
+    writer->fd = -1;
+    ifcd_counter_add(&ifcd_stream_lost, writer->header.count);
+    writer->size = writer->sent = 0;
+  }
+  for (ifcd_thread_t *th = __atomic_load_n(&ifcd_threads, __ATOMIC_ACQUIRE);
+       th != Null; th = th->next) {
+    ifcd_stream_ring_t *ring = &th->stream_ring;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    ifcd_counter_add(&ifcd_stream_lost, head - tail);
+    __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+  }
+}
+
+static void *ifcd_stream_main(void *context) {
+  static ifcd_stream_writer_t writer;
+  writer.ctx = (checkdenormal_context_t *)context;
+  writer.fd = -1;
+  writer.header.magic = CHECKDENORMAL_STREAM_MAGIC;
+  writer.header.pid = (uint32_t)getpid();
+  ifcd_stream_connect(&writer);
+  struct timespec pause = {0, IFCD_STREAM_POLL_MS * 1000000L};
+  while (!__atomic_load_n(&ifcd_stream_stop, __ATOMIC_ACQUIRE)) {
+    if (ifcd_stream_drain(&writer) == 0) {
+      nanosleep(&pause, Null);
+    }
+  }
+  /* The program is exiting: deliver what is left unless the collector */
+  /* does not keep up, then end with a header holding the final count of */
+  /* dropped events */
+  uint64_t deadline = ifcd_now_ns() + IFCD_STREAM_FINISH_MS * 1000000ULL;
+  for (;;) {
+    bool idle = ifcd_stream_drain(&writer) == 0;
+    if (idle && writer.sent == writer.size) {
+      break;
+    }
+    if (ifcd_now_ns() >= deadline) {
+      ifcd_stream_discard(&writer);
+      break;
+    }
+    if (idle) {
+      nanosleep(&pause, Null);
+    }
+  }
+  if (writer.fd >= 0) {
+    ifcd_stream_send(&writer, 0);
+    close(writer.fd);
+  }
+  return Null;
+}
+
+static void ifcd_stream_start(checkdenormal_context_t *ctx) {
+  if (pthread_create(&ifcd_stream_thread, Null, ifcd_stream_main, ctx) != 0) {
+    logger_error("cannot create the stream writer thread\n");
+  }
+}
+
+static void ifcd_stream_finish(void) {
+  __atomic_store_n(&ifcd_stream_stop, true, __ATOMIC_RELEASE);
+  pthread_join(ifcd_stream_thread, Null);
+}
+#else
+static void ifcd_stream_start(checkdenormal_context_t *) {}
+static void ifcd_stream_finish(void) {}
+#endif
+
+// * Watchpoints
+
+/* Registered buffers are scanned by a watcher thread. A hardware write   */
+/* breakpoint is armed on every thread at the first denormal found, fires */
+/* once per thread and is sampled with the stack of the writer, so that  */
+/* producers in uninstrumented code are found without slowing it down.  */
+
+#if IFCD_HAS_WATCH
+/* Read the value at index of a buffer concurrently written by the program */
+static double ifcd_watch_value(const ifcd_watch_buffer_t *buffer,
+                               size_t index) {
+  if (buffer->type == IFCD_FLOAT) {
+    uint32_t bits =
+        __atomic_load_n((uint32_t *)buffer->addr + index, __ATOMIC_RELAXED);
+    float value;
+    __builtin_memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+  uint64_t bits =
+      __atomic_load_n((uint64_t *)buffer->addr + index, __ATOMIC_RELAXED);
+  double value;
+  __builtin_memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/* Index of the first denormal of the buffer from next_scan, wrapping */
+/* around, or -1. Starting after the last watched value moves the */
+/* breakpoint across the denormal values instead of rearming one slot. */
+static long ifcd_watch_scan(const ifcd_watch_buffer_t *buffer) {
+  for (size_t n = 0; n < buffer->count; n++) {
+    size_t i = (buffer->next_scan + n) % buffer->count;
+    double value = ifcd_watch_value(buffer, i);
+    if ((buffer->type == IFCD_FLOAT) ? ifcd_is_denormal((float)value)
+                                     : ifcd_is_denormal(value)) {
+      return (long)i;
+    }
+  }
+  return -1;
+}
+
+static size_t ifcd_page_size(void) { return (size_t)sysconf(_SC_PAGESIZE); }
+
+static int ifcd_watch_open(pid_t tid, void *addr, ifcd_type_t type) {
+  struct perf_event_attr attr = {};
+  attr.type = PERF_TYPE_BREAKPOINT;
+  attr.size = sizeof(attr);
+  attr.bp_type = HW_BREAKPOINT_W;
+  attr.bp_addr = (uintptr_t)addr;
+  attr.bp_len =
+      (type == IFCD_FLOAT) ? HW_BREAKPOINT_LEN_4 : HW_BREAKPOINT_LEN_8;
+  attr.sample_period = 1;
+  attr.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.exclude_callchain_kernel = 1;
+  attr.sample_max_stack = IFCD_WATCH_FRAMES;
+  return (int)syscall(SYS_perf_event_open, &attr, tid, -1, -1,
+                      PERF_FLAG_FD_CLOEXEC);
+}
+
+static void ifcd_watch_disarm(ifcd_watch_buffer_t *buffer) {
+  size_t ring_size = (IFCD_WATCH_RING_PAGES + 1) * ifcd_page_size();
+  for (int i = 0; i < buffer->nb_events; i++) {
+    ioctl(buffer->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    munmap(buffer->rings[i], ring_size);
+    close(buffer->fds[i]);
+  }
+  buffer->nb_events = 0;
+  buffer->armed = -1;
+}
+
+/* Arm a breakpoint on the value at index in every thread of the process */
+static void ifcd_watch_arm(ifcd_watch_buffer_t *buffer, long index) {
+  size_t ring_size = (IFCD_WATCH_RING_PAGES + 1) * ifcd_page_size();
+  size_t size = (buffer->type == IFCD_FLOAT) ? sizeof(float) : sizeof(double);
+  void *addr = (char *)buffer->addr + index * size;
+  pid_t self = (pid_t)syscall(SYS_gettid);
+  int error = 0;
+  DIR *dir = opendir("/proc/self/task");
+  if (dir == Null) {
+    error = errno;
+  }
+  struct dirent *entry;
+  while (error == 0 && (entry = readdir(dir)) != Null &&
+         buffer->nb_events < IFCD_WATCH_THREADS) {
+    char *endptr;
+    int parse_error = 0;
+    pid_t tid = (pid_t)interflop_strtol(entry->d_name, &endptr, &parse_error);
+    if (parse_error != 0 || *endptr != '\0' || tid == self) {
+      continue;
+    }
+    int fd = ifcd_watch_open(tid, addr, buffer->type);
+    if (fd < 0) {
+      /* the thread may have exited since the directory was read */
+      if (errno != ESRCH) {
+        error = errno;
+      }
+      continue;
+    }
+    void *ring =
+        mmap(Null, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+      error = errno;
+      close(fd);
+      continue;
+    }
+    buffer->fds[buffer->nb_events] = fd;
+    buffer->rings[buffer->nb_events] = ring;
+    buffer->nb_events++;
+    /* Disable the breakpoint after its first hit */
+    ioctl(fd, PERF_EVENT_IOC_REFRESH, 1);
+  }
+  if (dir != Null) {
+    closedir(dir);
+  }
+  buffer->armed = index;
+  buffer->armed_scans = 0;
+  buffer->next_scan = (size_t)index + 1;
+  if (error != 0) {
+    ifcd_watch_disarm(buffer);
+    if (!buffer->warned) {
+      logger_warning("cannot watch %s[%ld]: %s\n", buffer->name, index,
+                     interflop_strerror(error));
+      buffer->warned = true;
+    }
+  }
+}
+
+/* Copy len bytes at offset of the data pages of a sample ring */
+static void ifcd_watch_copy(void *dst, const char *data, uint64_t offset,
+                            size_t len) {
+  size_t size = IFCD_WATCH_RING_PAGES * ifcd_page_size();
+  for (size_t i = 0; i < len; i++) {
+    ((char *)dst)[i] = data[(offset + i) & (size - 1)];
+  }
+}
+
+/* Record a sampled write, unless its instruction was already captured */
+static void ifcd_watch_capture(checkdenormal_context_t *ctx,
+                               ifcd_watch_buffer_t *buffer,
+                               const uint64_t *sample, size_t words) {
+  if (buffer->nb_captures == ctx->watch || words < 3) {
+    return;
+  }
+  ifcd_watch_capture_t *capture = &buffer->captures[buffer->nb_captures];
+  capture->index = (size_t)buffer->armed;
+  capture->value = ifcd_watch_value(buffer, capture->index);
+  /* ip, pid and tid, callchain size and callchain */
+  capture->tid = (int)(sample[1] >> 32);
+  capture->nb_frames = 0;
+  uint64_t nr = std::min<uint64_t>(sample[2], words - 3);
+  for (uint64_t i = 0; i < nr && capture->nb_frames < IFCD_WATCH_FRAMES;
+       i++) {
+    /* skip the context markers */
+    if (sample[3 + i] < (uint64_t)PERF_CONTEXT_MAX) {
+      capture->frames[capture->nb_frames++] = (void *)sample[3 + i];
+    }
+  }
+  if (capture->nb_frames == 0) {
+    capture->frames[capture->nb_frames++] = (void *)sample[0];
+  }
+  for (unsigned int i = 0; i < buffer->nb_captures; i++) {
+    if (buffer->captures[i].frames[0] == capture->frames[0]) {
+      return;
+    }
+  }
+  buffer->nb_captures++;
+}
+
+/* Record the writers sampled by the breakpoints of the buffer, and disarm */
+/* it once hit so that the next scan moves it to the next denormal */
+static void ifcd_watch_poll(checkdenormal_context_t *ctx,
+                            ifcd_watch_buffer_t *buffer) {
+  bool hit = false;
+  for (int i = 0; i < buffer->nb_events; i++) {
+    struct perf_event_mmap_page *page =
+        (struct perf_event_mmap_page *)buffer->rings[i];
+    const char *data = (const char *)buffer->rings[i] + ifcd_page_size();
+    uint64_t head = __atomic_load_n(&page->data_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = page->data_tail;
+    while (tail < head) {
+      struct perf_event_header header;
+      ifcd_watch_copy(&header, data, tail, sizeof(header));
+      if (header.type == PERF_RECORD_SAMPLE) {
+        uint64_t sample[3 + 2 * IFCD_WATCH_FRAMES];
+        size_t len =
+            std::min<size_t>(header.size - sizeof(header), sizeof(sample));
+        ifcd_watch_copy(sample, data, tail + sizeof(header), len);
+        ifcd_watch_capture(ctx, buffer, sample, len / sizeof(uint64_t));
+        hit = true;
+      }
+      tail += header.size;
+    }
+    __atomic_store_n(&page->data_tail, tail, __ATOMIC_RELEASE);
+  }
+  if (hit || ++buffer->armed_scans == IFCD_WATCH_REFRESH) {
+    ifcd_watch_disarm(buffer);
+  }
+}
+
+static void *ifcd_watch_main(void *context) {
+  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
+  while (!__atomic_load_n(&ifcd_watch_stop, __ATOMIC_ACQUIRE)) {
+    pthread_mutex_lock(&ifcd_watch_lock);
+    for (int i = 0; i < ifcd_nb_watch_buffers; i++) {
+      ifcd_watch_buffer_t *buffer = &ifcd_watch_buffers[i];
+      if (buffer->armed >= 0) {
+        ifcd_watch_poll(ctx, buffer);
+      }
+      if (buffer->addr != Null && buffer->armed < 0 &&
+          buffer->nb_captures < ctx->watch) {
+        long index = ifcd_watch_scan(buffer);
+        if (index >= 0) {
+          ifcd_watch_arm(buffer, index);
+        }
+      }
+    }
+    pthread_mutex_unlock(&ifcd_watch_lock);
+    struct timespec pause = {(time_t)(ctx->watch_interval / 1000),
+                             (long)(ctx->watch_interval % 1000) * 1000000L};
+    nanosleep(&pause, Null);
+  }
+  return Null;
+}
+
+static void ifcd_watch_start(checkdenormal_context_t *ctx) {
+  if (pthread_create(&ifcd_watch_thread, Null, ifcd_watch_main, ctx) != 0) {
+    logger_error("cannot create the watcher thread\n");
+  }
+}
+
+static void ifcd_watch_finish(checkdenormal_context_t *ctx) {
+  __atomic_store_n(&ifcd_watch_stop, true, __ATOMIC_RELEASE);
+  pthread_join(ifcd_watch_thread, Null);
+  for (int i = 0; i < ifcd_nb_watch_buffers; i++) {
+    ifcd_watch_buffer_t *buffer = &ifcd_watch_buffers[i];
+    if (buffer->armed >= 0) {
+      ifcd_watch_poll(ctx, buffer);
+    }
+    if (buffer->armed >= 0) {
+      ifcd_watch_disarm(buffer);
+    }
+  }
+}
+
+static void ifcd_watch_register(const char *name, void *addr, size_t count,
+                                int type) {
+  if (type != FFLOAT && type != FDOUBLE) {
+    logger_warning("cannot watch %s: only FFLOAT and FDOUBLE buffers are "
+                   "supported\n",
+                   name);
+    return;
+  }
+  pthread_mutex_lock(&ifcd_watch_lock);
+  if (ifcd_nb_watch_buffers == IFCD_WATCH_BUFFERS) {
+    pthread_mutex_unlock(&ifcd_watch_lock);
+    logger_warning("cannot watch %s: at most %d buffers are supported\n", name,
+                   IFCD_WATCH_BUFFERS);
+    return;
+  }
+  /* the slot may hold the state of an unregistered buffer */
+  ifcd_watch_buffer_t *buffer = &ifcd_watch_buffers[ifcd_nb_watch_buffers++];
+  *buffer = ifcd_watch_buffer_t();
+  interflop_sprintf(buffer->name, "%.63s", name ? name : "??");
+  buffer->addr = addr;
+  buffer->count = count;
+  buffer->type = (type == FFLOAT) ? IFCD_FLOAT : IFCD_DOUBLE;
+  buffer->armed = -1;
+  pthread_mutex_unlock(&ifcd_watch_lock);
+}
+
+/* Move the captures of the buffer to the report and free its slot */
+static void ifcd_watch_unregister(void *addr) {
+  pthread_mutex_lock(&ifcd_watch_lock);
+  for (int i = 0; i < ifcd_nb_watch_buffers;) {
+    ifcd_watch_buffer_t *buffer = &ifcd_watch_buffers[i];
+    if (buffer->addr != addr) {
+      i++;
+      continue;
+    }
+    if (buffer->armed >= 0) {
+      ifcd_watch_disarm(buffer);
+    }
+    for (unsigned int j = 0; j < buffer->nb_captures; j++) {
+      if (ifcd_nb_watch_reports == IFCD_WATCH_REPORTS) {
+        ifcd_watch_reports_dropped++;
+        continue;
+      }
+      ifcd_watch_report_t *report =
+          &ifcd_watch_reports[ifcd_nb_watch_reports++];
+      interflop_sprintf(report->name, "%s", buffer->name);
+      report->capture = buffer->captures[j];
+    }
+    *buffer = ifcd_watch_buffers[--ifcd_nb_watch_buffers];
+  }
+  pthread_mutex_unlock(&ifcd_watch_lock);
+}
+#else
+static void ifcd_watch_start(checkdenormal_context_t *) {}
+static void ifcd_watch_finish(checkdenormal_context_t *) {}
+static void ifcd_watch_register(const char *, void *, size_t, int) {}
+static void ifcd_watch_unregister(void *) {}
+#endif
+
+// * Events
+
+/* Record a denormal result for the per-event reports */
+template <ifcd_op_t OP, typename REAL>
+static inline __attribute__((always_inline)) void
+ifcd_event(checkdenormal_context_t *ctx, REAL value, ifcd_op_site_t *op_site) {
+  if (ctx->heatmap == Null && ctx->stream == Null && !ctx->calling_context) {
+    return;
+  }
+  ifcd_thread_t *th = ifcd_thread();
+  /* --calling-context alone does not read the clock */
+  bool timed =
+      ctx->heatmap != Null || ctx->stream != Null || ctx->metrics != Null;
+  uint64_t now = timed ? ifcd_now_ns() : 0;
+  void *site = ifcd_op_site_addr(op_site, ctx);
+  if (ctx->heatmap != Null) {
+    ifcd_heatmap_record(&th->heatmap, site, now, ctx);
+  }
+  if (ctx->calling_context && site != Null) {
+    ifcd_context_t *context =
+        ifcd_context_lookup(&th->context_table, site, th->context_hash);
+    if (context != Null && context->site == Null) {
+      /* Capture a representative stack once per new context */
+      context->hash = th->context_hash;
+      context->nb_frames = ifcd_get_stack(context->frames, ctx->site_depth);
+      __atomic_store_n(&context->site, site, __ATOMIC_RELEASE);
+    }
+    if (context != Null) {
+      ifcd_counter_add(&context->denormals, 1);
+    }
+  }
+  if (ctx->stream != Null) {
+    ifcd_stream_event_t ev = {now,
+                              site,
+                              th->context_hash,
+                              (double)value,
+                              OP,
+                              (uint8_t)ifcd_op_type<OP, REAL>(),
+                              th->tid};
+    ifcd_stream_push(th, &ev);
+  }
+  if (ctx->metrics != Null) {
+    ifcd_counter_add(&th->overhead_ns, ifcd_now_ns() - now);
+  }
+}
+
+// * Metrics
+
+typedef struct ifcd_metrics {
+  uint64_t operations[IFCD_OP_END][IFCD_TYPE_END];
+  uint64_t denormals[IFCD_OP_END][IFCD_TYPE_END];
+  uint64_t flushes;
+  uint64_t dropped;
+  uint64_t overhead_ns;
+  uint64_t alerts;
+  uint64_t threads;
+} ifcd_metrics_t;
+
+static void ifcd_metrics_collect(ifcd_metrics_t *metrics) {
+  *metrics = ifcd_metrics_t();
+  for (ifcd_thread_t *th = __atomic_load_n(&ifcd_threads, __ATOMIC_ACQUIRE);
+       th != Null; th = th->next) {
+    for (int op = 0; op < IFCD_OP_END; op++) {
+      for (int type = 0; type < IFCD_TYPE_END; type++) {
+        metrics->operations[op][type] +=
+            ifcd_counter_read(&th->operations[op][type]);
+        metrics->denormals[op][type] +=
+            ifcd_counter_read(&th->denormals[op][type]);
+      }
+    }
+    metrics->flushes += ifcd_counter_read(&th->flushes);
+    metrics->dropped += ifcd_counter_read(&th->site_table.dropped) +
+                        ifcd_counter_read(&th->boundary_table.dropped) +
+                        ifcd_counter_read(&th->context_table.dropped) +
+                        ifcd_counter_read(&th->stream_dropped);
+    metrics->overhead_ns += ifcd_counter_read(&th->overhead_ns);
+    metrics->alerts += ifcd_counter_read(&th->alerts);
+    metrics->threads += __atomic_load_n(&th->owned, __ATOMIC_RELAXED);
+  }
+  metrics->dropped += ifcd_counter_read(&ifcd_stream_lost);
+}
+
+static void ifcd_metrics_header(File *out, const char *name,
+                                const char *type, const char *help) {
+  interflop_fprintf(out, "# HELP checkdenormal_%s %s\n", name, help);
+  interflop_fprintf(out, "# TYPE checkdenormal_%s %s\n", name, type);
+}
+
+/* Write the merged counters in Prometheus text format to a temporary file */
+/* renamed over the metrics file, as expected by the textfile collector. */
+/* Concurrent calls are skipped unless wait is set. */
+static void ifcd_metrics_write(checkdenormal_context_t *ctx, bool wait) {
+  bool expected = false;
+  while (!__atomic_compare_exchange_n(&ifcd_metrics_writing, &expected, true,
+                                      false, __ATOMIC_ACQUIRE,
+                                      __ATOMIC_RELAXED)) {
+    if (!wait) {
+      return;
+    }
+    expected = false;
+  }
+
+  ifcd_metrics_t metrics;
+  ifcd_metrics_collect(&metrics);
+
+  char tmp_path[4096];
+#if IFCD_USE_LIBC
+  interflop_sprintf(tmp_path, "%.4000s.%d.tmp", ctx->metrics, (int)getpid());
+#else
+  /* written in place, readers may see a partial file */
+  interflop_sprintf(tmp_path, "%.4000s", ctx->metrics);
+#endif
+  int error = 0;
+  File *out = interflop_fopen(tmp_path, "w", &error);
+  if (out == Null) {
+    logger_warning("cannot open metrics file %s: %s\n", tmp_path,
+                   interflop_strerror(error));
+    __atomic_store_n(&ifcd_metrics_writing, false, __ATOMIC_RELEASE);
+    return;
+  }
+
+  ifcd_metrics_header(out, "operations_total", "counter",
+                      "Floating-point operations checked.");
+  for (int op = 0; op < IFCD_OP_END; op++) {
+    for (int type = 0; type < IFCD_TYPE_END; type++) {
+      interflop_fprintf(out,
+                        "checkdenormal_operations_total{op=\"%s\","
+                        "type=\"%s\"} %lu\n",
+                        ifcd_op_name[op], ifcd_type_name[type],
+                        metrics.operations[op][type]);
+    }
+  }
+  ifcd_metrics_header(out, "denormals_total", "counter",
+                      "Operations producing a denormal result.");
+  for (int op = 0; op < IFCD_OP_END; op++) {
+    for (int type = 0; type < IFCD_TYPE_END; type++) {
+      interflop_fprintf(out,
+                        "checkdenormal_denormals_total{op=\"%s\","
+                        "type=\"%s\"} %lu\n",
+                        ifcd_op_name[op], ifcd_type_name[type],
+                        metrics.denormals[op][type]);
+    }
+  }
+  ifcd_metrics_header(out, "denormal_ratio", "gauge",
+                      "Fraction of operations producing a denormal result.");
+  for (int op = 0; op < IFCD_OP_END; op++) {
+    for (int type = 0; type < IFCD_TYPE_END; type++) {
+      uint64_t operations = metrics.operations[op][type];
+      interflop_fprintf(out,
+                        "checkdenormal_denormal_ratio{op=\"%s\","
+                        "type=\"%s\"} %g\n",
+                        ifcd_op_name[op], ifcd_type_name[type],
+                        operations ? (double)metrics.denormals[op][type] /
+                                         operations
+                                   : 0.);
+    }
+  }
+  ifcd_metrics_header(out, "flushes_total", "counter",
+                      "Denormal results flushed to zero.");
+  interflop_fprintf(out, "checkdenormal_flushes_total %lu\n",
+                    metrics.flushes);
+  ifcd_metrics_header(out, "events_dropped_total", "counter",
+                      "Events not recorded or not delivered to the collector.");
+  interflop_fprintf(out, "checkdenormal_events_dropped_total %lu\n",
+                    metrics.dropped);
+  ifcd_metrics_header(out, "overhead_seconds_total", "counter",
+                      "Time spent recording events and writing metrics.");
+  interflop_fprintf(out, "checkdenormal_overhead_seconds_total %.9f\n",
+                    metrics.overhead_ns * 1e-9);
+  ifcd_metrics_header(out, "alerts_total", "counter",
+                      "Alert rules fired by a thread window.");
+  interflop_fprintf(out, "checkdenormal_alerts_total %lu\n", metrics.alerts);
+  ifcd_metrics_header(out, "threads", "gauge",
+                      "Live threads that performed floating-point operations.");
+  interflop_fprintf(out, "checkdenormal_threads %lu\n", metrics.threads);
+  interflop_fclose(out);
+
+#if IFCD_USE_LIBC
+  if (rename(tmp_path, ctx->metrics) != 0) {
+    logger_warning("cannot rename metrics file %s\n", tmp_path);
+  }
+#endif
+  __atomic_store_n(&ifcd_metrics_writing, false, __ATOMIC_RELEASE);
+}
+
+// * Alerts
+
+/* Defined with the finalize report */
+extern "C" {
+static void ifcd_report_write(checkdenormal_context_t *ctx, const char *path,
+                              const char *title);
+}
+
+/* Format an alert rule as given to --alert */
+static void ifcd_alert_format(char *buf, const checkdenormal_alert_t *alert) {
+  interflop_sprintf(buf, "%s_%s>%g%%/%ums:%s",
+                    alert->op < 0 ? "any" : ifcd_op_name[alert->op],
+                    alert->type < 0 ? "any" : ifcd_type_name[alert->type],
+                    alert->threshold * 100, alert->window_ms,
+                    ifcd_alert_action_name[alert->action]);
+}
+
+static void ifcd_alert_fire(checkdenormal_context_t *ctx, ifcd_thread_t *th,
+                            unsigned int index, uint64_t denormals,
+                            uint64_t operations) {
+  const checkdenormal_alert_t *alert = &ctx->alerts[index];
+  char rule[128];
+  ifcd_alert_format(rule, alert);
+  ifcd_counter_add(&th->alerts, 1);
+  logger_warning("alert %s fired in thread %d: %lu denormals out of %lu "
+                 "operations\n",
+                 rule, th->tid, denormals, operations);
+  switch (alert->action) {
+  case CHECKDENORMAL_ALERT_LOG:
+    break;
+  case CHECKDENORMAL_ALERT_REPORT: {
+    /* Snapshot of the finalize report, next to the report file */
+    unsigned int snapshot =
+        __atomic_fetch_add(&ifcd_alert_snapshots, 1, __ATOMIC_RELAXED);
+    char title[256];
+    interflop_sprintf(title, "# alert %s fired in thread %d\n", rule, th->tid);
+    if (ctx->report_file == Null) {
+      ifcd_report_write(ctx, Null, title);
+    } else {
+      char path[4096];
+      interflop_sprintf(path, "%.4000s.alert%u", ctx->report_file, snapshot);
+      ifcd_report_write(ctx, path, title);
+    }
+    if (ctx->metrics != Null) {
+      ifcd_metrics_write(ctx, false);
+    }
+    break;
+  }
+  case CHECKDENORMAL_ALERT_TRAP:
+#if IFCD_USE_LIBC
+    raise(SIGTRAP);
+#endif
+    break;
+  case CHECKDENORMAL_ALERT_HANDLER:
+    if (interflop_denormalHandler != Null) {
+      interflop_denormalHandler();
+    }
+    break;
+  }
+}
+
+/* Operations and denormals of the thread matching the rule */
+static void ifcd_alert_totals(const checkdenormal_alert_t *alert,
+                              const ifcd_thread_t *th, uint64_t *operations,
+                              uint64_t *denormals) {
+  *operations = 0;
+  *denormals = 0;
+  for (int op = 0; op < IFCD_OP_END; op++) {
+    for (int type = 0; type < IFCD_TYPE_END; type++) {
+      if ((alert->op < 0 || alert->op == op) &&
+          (alert->type < 0 || alert->type == type)) {
+        *operations += th->operations[op][type];
+        *denormals += th->denormals[op][type];
+      }
+    }
+  }
+}
+
+/* Close the elapsed alert windows of the thread and fire the rules whose */
+/* denormal rate exceeded the threshold, once per run of such windows */
+static void ifcd_alerts_check(checkdenormal_context_t *ctx, ifcd_thread_t *th,
+                              uint64_t now) {
+  for (unsigned int i = 0; i < ctx->nb_alerts; i++) {
+    const checkdenormal_alert_t *alert = &ctx->alerts[i];
+    ifcd_alert_window_t *window = &th->alert_windows[i];
+    uint64_t operations, denormals;
+    if (window->start_ns == 0) {
+      /* the first window of the owner starts at its first check, after */
+      /* the operations of a previous owner of the state */
+      ifcd_alert_totals(alert, th, &operations, &denormals);
+      window->start_ns = now;
+      window->operations = operations;
+      window->denormals = denormals;
+      window->firing = false;
+      continue;
+    }
+    if (now - window->start_ns < (uint64_t)alert->window_ms * 1000000ULL) {
+      continue;
+    }
+    ifcd_alert_totals(alert, th, &operations, &denormals);
+    uint64_t window_operations = operations - window->operations;
+    uint64_t window_denormals = denormals - window->denormals;
+    window->start_ns = now;
+    window->operations = operations;
+    window->denormals = denormals;
+    bool exceeded = window_operations != 0 &&
+                    (double)window_denormals >
+                        alert->threshold * (double)window_operations;
+    if (exceeded && !window->firing) {
+      ifcd_alert_fire(ctx, th, i, window_denormals, window_operations);
+    }
+    window->firing = exceeded;
+  }
+}
+
+/* Update the metrics file when its period elapsed and evaluate the alerts */
+static __attribute__((noinline)) void
+ifcd_periodic_check(checkdenormal_context_t *ctx, ifcd_thread_t *th) {
+  uint64_t now = ifcd_now_ns();
+  if (ctx->metrics != Null) {
+    uint64_t deadline =
+        __atomic_load_n(&ifcd_metrics_deadline_ns, __ATOMIC_RELAXED);
+    if (now >= deadline &&
+        __atomic_compare_exchange_n(
+            &ifcd_metrics_deadline_ns, &deadline,
+            now + (uint64_t)ctx->metrics_interval * 1000000000ULL, false,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      ifcd_metrics_write(ctx, false);
+    }
+  }
+  ifcd_alerts_check(ctx, th, now);
+  if (ctx->metrics != Null) {
+    ifcd_counter_add(&th->overhead_ns, ifcd_now_ns() - now);
+  }
+}
+
+/* Count the operation for the metrics and the alerts */
+template <ifcd_op_t OP, typename REAL>
+static inline void ifcd_count(checkdenormal_context_t *ctx, bool denormal,
+                              bool flush) {
+  ifcd_thread_t *th = ifcd_thread();
+  ifcd_type_t type = ifcd_op_type<OP, REAL>();
+  ifcd_counter_add(&th->operations[OP][type], 1);
+  if (denormal) {
+    ifcd_counter_add(&th->denormals[OP][type], 1);
+  }
+  if (flush) {
+    ifcd_counter_add(&th->flushes, 1);
+  }
+  if (__builtin_expect(th->check_countdown-- == 0, 0)) {
+    th->check_countdown = IFCD_CHECK_PERIOD;
+    ifcd_periodic_check(ctx, th);
+  }
+}
+
+// * Function boundaries
+
+template <typename REAL>
+static void ifcd_boundary_check(ifcd_arg_t *arg, const REAL *values,
+                                unsigned int size) {
+  for (unsigned int i = 0; i < size; i++) {
+    ifcd_counter_add(&arg->checked, 1);
+    if (ifcd_is_denormal(values[i])) {
+      ifcd_counter_add(&arg->denormal, 1);
+    }
+  }
+}
+
+// * Selective flush
+
+static bool ifcd_flush_site_less(const ifcd_flush_site_t &a,
+                                 const ifcd_flush_site_t &b) {
+  return a.module < b.module || (a.module == b.module && a.offset < b.offset);
+}
+
+/* Parse the site at the start of line, as printed in the reports: */
+/* module+0xoffset, optionally followed by (symbol) or a comma */
+static bool ifcd_flush_site_parse(const char *line, ifcd_flush_site_t *site) {
+  const char *end = line;
+  while (*end != '\0' && *end != '(' && *end != ',' && *end != ' ' &&
+         *end != '\t') {
+    end++;
+  }
+  const char *plus = Null;
+  for (const char *p = line; p < end; p++) {
+    if (*p == '+') {
+      plus = p;
+    }
+  }
+  if (plus == Null || plus == line || plus + 3 > end || plus[1] != '0' ||
+      (plus[2] != 'x' && plus[2] != 'X')) {
+    return false;
+  }
+  char module[4096];
+  size_t length = std::min<size_t>(plus - line, sizeof(module) - 1);
+  for (size_t i = 0; i < length; i++) {
+    module[i] = line[i];
+  }
+  module[length] = '\0';
+  site->module = ifcd_module_hash(module);
+  site->offset = 0;
+  for (const char *p = plus + 3; p < end; p++) {
+    int digit = (*p >= '0' && *p <= '9')   ? *p - '0'
+                : (*p >= 'a' && *p <= 'f') ? *p - 'a' + 10
+                : (*p >= 'A' && *p <= 'F') ? *p - 'A' + 10
+                                           : -1;
+    if (digit < 0) {
+      return false;
+    }
+    site->offset = site->offset * 16 + digit;
+  }
+  return true;
+}
+
+/* Read the sites of --flush-sites, one per line, # starting a comment */
+static void ifcd_flush_sites_load(checkdenormal_context_t *ctx) {
+  INTERFLOP_CHECK_IMPL(fgets);
+  int error = 0;
+  File *in = interflop_fopen(ctx->flush_sites, "r", &error);
+  if (in == Null) {
+    logger_error("cannot open --%s file %s: %s\n", key_flush_sites_str,
+                 ctx->flush_sites, interflop_strerror(error));
+  }
+  size_t capacity = 0;
+  unsigned int line_number = 0;
+  /* module paths are at most PATH_MAX long */
+  char line[4096 + 64];
+  /* the previous read ended inside a comment, or inside a site */
+  bool comment = false, truncated = false;
+  while (interflop_fgets(line, sizeof(line), in) != Null) {
+    if (truncated) {
+      logger_error("--%s line too long at %s:%u\n", key_flush_sites_str,
+                   ctx->flush_sites, line_number);
+    }
+    char *end = line;
+    while (*end != '\0' && *end != '\n') {
+      end++;
+    }
+    bool partial = (*end != '\n');
+    *end = '\0';
+    if (comment) {
+      comment = partial;
+      continue;
+    }
+    line_number++;
+    char *start = line;
+    while (*start == ' ' || *start == '\t') {
+      start++;
+    }
+    if (*start == '\0' || *start == '#' || *start == '\r') {
+      comment = partial;
+      continue;
+    }
+    truncated = partial;
+    if (ifcd_nb_flush_sites == capacity) {
+      capacity = (capacity == 0) ? 64 : 2 * capacity;
+      ifcd_flush_site_t *larger = (ifcd_flush_site_t *)interflop_malloc(
+          capacity * sizeof(ifcd_flush_site_t));
+      for (size_t i = 0; i < ifcd_nb_flush_sites; i++) {
+        larger[i] = ifcd_flush_sites[i];
+      }
+      interflop_free(ifcd_flush_sites);
+      ifcd_flush_sites = larger;
+    }
+    if (!ifcd_flush_site_parse(start,
+                               &ifcd_flush_sites[ifcd_nb_flush_sites])) {
+      logger_error("--%s invalid site at %s:%u, must be module+0xoffset\n",
+                   key_flush_sites_str, ctx->flush_sites, line_number);
+    }
+    ifcd_nb_flush_sites++;
+  }
+  interflop_fclose(in);
+  std::sort(ifcd_flush_sites, ifcd_flush_sites + ifcd_nb_flush_sites,
+            ifcd_flush_site_less);
+}
+
+/* Whether the site is listed in --flush-sites */
+static __attribute__((noinline)) bool ifcd_flush_site_find(void *site) {
+  Dl_info info;
+  if (site == Null || dladdr(site, &info) == 0 || info.dli_fname == Null) {
+    return false;
+  }
+  ifcd_flush_site_t key = {ifcd_module_hash(info.dli_fname),
+                           (uintptr_t)site - (uintptr_t)info.dli_fbase};
+  return std::binary_search(ifcd_flush_sites,
+                            ifcd_flush_sites + ifcd_nb_flush_sites, key,
+                            ifcd_flush_site_less);
+}
+
+/* Whether a denormal result of the current call site is flushed to zero */
+static inline __attribute__((always_inline)) bool
+ifcd_flushed(checkdenormal_context_t *ctx, ifcd_op_site_t *op_site) {
+  if (ctx->flushtozero) {
+    return true;
+  }
+  /* no site listed, or an empty --flush-sites file: skip the unwinding */
+  if (ifcd_nb_flush_sites == 0) {
+    return false;
+  }
+  ifcd_thread_t *th = ifcd_thread();
+  void *site = ifcd_op_site_addr(op_site, ctx);
+  ifcd_flush_entry_t *entry =
+      &th->flush_cache[(ifcd_hash_ptr(site) >> 56) & (IFCD_FLUSH_CACHE - 1)];
+  if (entry->site != site || site == Null) {
+    entry->site = site;
+    entry->flush = ifcd_flush_site_find(site);
+  }
+  return entry->flush;
+}
+
+template <ifcd_op_t OP, class REAL>
+inline __attribute__((always_inline)) void
+flushToZeroAndCheck(REAL *res, checkdenormal_context_t *ctx,
+                    ifcd_op_site_t *op_site) {
+  bool denormal =
+      std::abs(*res) < std::numeric_limits<REAL>::min() && *res != 0.;
+  bool flush = denormal && ifcd_flushed(ctx, op_site);
+  if (ctx->metrics != Null || ctx->nb_alerts != 0) {
+    ifcd_count<OP, REAL>(ctx, denormal, flush);
+  }
+  if (denormal) {
+    ifcd_event<OP>(ctx, *res, op_site);
+    if (interflop_denormalHandler != Null) {
+      interflop_denormalHandler();
+    }
+    if (flush) {
+      *res = 0.;
+    }
+  }
+}
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// * C interface
+
+static void _set_checkdenormal_ftz(bool ftz, checkdenormal_context_t *ctx) {
+  ctx->flushtozero = ftz;
+}
+
+static void _set_checkdenormal_latency_sampling(unsigned int period,
+                                                checkdenormal_context_t *ctx) {
+#if !IFCD_HAS_CYCLES
+  if (period != 0) {
+    logger_error("--%s is only supported on x86_64\n",
+                 key_latency_sampling_str);
+  }
+#endif
+  ctx->latency_sampling = period;
+}
+
+static void _set_checkdenormal_rescale_sampling(unsigned int period,
+                                                checkdenormal_context_t *ctx) {
+  ctx->rescale_sampling = period;
+}
+
+static void _set_checkdenormal_extended_shadow(bool shadow,
+                                               checkdenormal_context_t *ctx) {
+#if !IFCD_HAS_EXTENDED
+  if (shadow) {
+    logger_error("--%s requires a long double wider than double\n",
+                 key_extended_shadow_str);
+  }
+#endif
+  ctx->extended_shadow = shadow;
+}
+
+static void
+_set_checkdenormal_function_boundaries(bool boundaries,
+                                       checkdenormal_context_t *ctx) {
+  ctx->function_boundaries = boundaries;
+}
+
+static void _set_checkdenormal_calling_context(bool context,
+                                               checkdenormal_context_t *ctx) {
+#if !IFCD_USE_LIBC
+  if (context) {
+    logger_error("--%s requires libc\n", key_calling_context_str);
+  }
+#endif
+  ctx->calling_context = context;
+}
+
+static void _set_checkdenormal_heatmap(const char *prefix,
+                                       checkdenormal_context_t *ctx) {
+  if (prefix != Null && interflop_gettimeofday == Null) {
+    logger_error("--%s requires interflop_gettimeofday\n", key_heatmap_str);
+  }
+  ctx->heatmap = prefix;
+}
+
+static void _set_checkdenormal_heatmap_window(unsigned int window,
+                                              checkdenormal_context_t *ctx) {
+  if (window == 0) {
+    logger_error("--%s must be positive\n", key_heatmap_window_str);
+  }
+  ctx->heatmap_window = window;
+}
+
+static void _set_checkdenormal_metrics(const char *path,
+                                       checkdenormal_context_t *ctx) {
+  if (path != Null && interflop_gettimeofday == Null) {
+    logger_error("--%s requires interflop_gettimeofday\n", key_metrics_str);
+  }
+  ctx->metrics = path;
+}
+
+static void _set_checkdenormal_metrics_interval(unsigned int interval,
+                                                checkdenormal_context_t *ctx) {
+  if (interval == 0) {
+    logger_error("--%s must be positive\n", key_metrics_interval_str);
+  }
+  ctx->metrics_interval = interval;
+}
+
+static void _set_checkdenormal_stream(const char *url,
+                                      checkdenormal_context_t *ctx) {
+  static const char prefix[] = "unix:";
+  if (url == Null) {
+    ctx->stream = Null;
+    return;
+  }
+#if !IFCD_USE_LIBC
+  logger_error("--%s requires libc\n", key_stream_str);
+#endif
+  for (size_t i = 0; i < sizeof(prefix) - 1; i++) {
+    if (url[i] != prefix[i]) {
+      logger_error("--%s only supports unix:/path\n", key_stream_str);
+    }
+  }
+  const char *path = url + sizeof(prefix) - 1;
+  size_t length = 0;
+  while (path[length] != '\0') {
+    length++;
+  }
+#if IFCD_USE_LIBC
+  if (length == 0 || length >= sizeof(((struct sockaddr_un *)0)->sun_path)) {
+    logger_error("--%s invalid socket path: %s\n", key_stream_str, path);
+  }
+#endif
+  if (interflop_gettid == Null) {
+    logger_error("--%s requires interflop_gettid\n", key_stream_str);
+  }
+  if (interflop_gettimeofday == Null) {
+    logger_error("--%s requires interflop_gettimeofday\n", key_stream_str);
+  }
+  ctx->stream = path;
+}
+
+static void _set_checkdenormal_record(const char *path,
+                                      checkdenormal_context_t *ctx) {
+  ctx->record = path;
+}
+
+static void _set_checkdenormal_flush_sites(const char *path,
+                                           checkdenormal_context_t *ctx) {
+  /* an empty path disables the selective flush, as for the ddmin baseline */
+  if (path != Null && path[0] == '\0') {
+    path = Null;
+  }
+#if !IFCD_USE_LIBC
+  if (path != Null) {
+    logger_error("--%s requires libc\n", key_flush_sites_str);
+  }
+#endif
+  ctx->flush_sites = path;
+}
+
+static void _set_checkdenormal_watch(unsigned int watch,
+                                     checkdenormal_context_t *ctx) {
+#if !IFCD_HAS_WATCH
+  if (watch != 0) {
+    logger_error("--%s is only supported on Linux with libc\n",
+                 key_watch_str);
+  }
+#endif
+  if (watch > IFCD_WATCH_CAPTURES) {
+    logger_error("--%s must be at most %d\n", key_watch_str,
+                 IFCD_WATCH_CAPTURES);
+  }
+  ctx->watch = watch;
+}
+
+static void _set_checkdenormal_watch_interval(unsigned int interval,
+                                              checkdenormal_context_t *ctx) {
+  if (interval == 0) {
+    logger_error("--%s must be positive\n", key_watch_interval_str);
+  }
+  ctx->watch_interval = interval;
+}
+
+static void _set_checkdenormal_alert(const checkdenormal_alert_t *alert,
+                                     checkdenormal_context_t *ctx) {
+  if (ctx->nb_alerts == CHECKDENORMAL_MAX_ALERTS) {
+    logger_error("--%s at most %d rules are supported\n", key_alert_str,
+                 CHECKDENORMAL_MAX_ALERTS);
+  }
+  if (alert->op < -1 || alert->op >= IFCD_OP_END || alert->type < -1 ||
+      alert->type >= IFCD_TYPE_END || alert->action < CHECKDENORMAL_ALERT_LOG ||
+      alert->action > CHECKDENORMAL_ALERT_HANDLER) {
+    logger_error("--%s invalid rule\n", key_alert_str);
+  }
+  if (alert->window_ms == 0) {
+    logger_error("--%s window must be positive\n", key_alert_str);
+  }
+#if !IFCD_USE_LIBC
+  if (alert->action == CHECKDENORMAL_ALERT_TRAP) {
+    logger_error("--%s trap action requires libc\n", key_alert_str);
+  }
+#endif
+  if (interflop_gettimeofday == Null) {
+    logger_error("--%s requires interflop_gettimeofday\n", key_alert_str);
+  }
+  ctx->alerts[ctx->nb_alerts++] = *alert;
+}
+
+static void _set_checkdenormal_alerts(const checkdenormal_alert_t *alerts,
+                                      unsigned int nb_alerts,
+                                      checkdenormal_context_t *ctx) {
+  if (nb_alerts > CHECKDENORMAL_MAX_ALERTS) {
+    logger_error("--%s at most %d rules are supported\n", key_alert_str,
+                 CHECKDENORMAL_MAX_ALERTS);
+  }
+  /* alerts may be ctx->alerts when configuring the context with itself */
+  checkdenormal_alert_t copy[CHECKDENORMAL_MAX_ALERTS];
+  for (unsigned int i = 0; i < nb_alerts; i++) {
+    copy[i] = alerts[i];
+  }
+  ctx->nb_alerts = 0;
+  for (unsigned int i = 0; i < nb_alerts; i++) {
+    _set_checkdenormal_alert(&copy[i], ctx);
+  }
+}
+
+static void _set_checkdenormal_site_depth(unsigned int depth,
+                                          checkdenormal_context_t *ctx) {
+  /* depth 0 would be the backend entry point itself */
+  if (depth == 0 || depth > IFCD_MAX_SITE_DEPTH) {
+    logger_error("--%s must be between 1 and %d\n", key_site_depth_str,
+                 IFCD_MAX_SITE_DEPTH);
+  }
+  ctx->site_depth = depth;
+}
+
+static void _set_checkdenormal_report_file(const char *path,
+                                           checkdenormal_context_t *ctx) {
+  ctx->report_file = path;
+}
+
+#ifdef IFCD_DOOP
+#define APPLYOP(a, b, res, op)                                                 \
+  ifcd_op_site_t op_site = {Null, false};                                      \
+  *res = ifcd_doop<op>(a, b, decltype(a)(0), ctx, &op_site);                   \
+  ifcd_profile<op>(a, b, decltype(a)(0), *res, ctx, &op_site);                 \
+  ifcd_shadow<op>(a, b, decltype(a)(0), *res, ctx, &op_site);                  \
+  ifcd_record<op>(a, b, decltype(a)(0), *res, ctx, &op_site);                  \
+  flushToZeroAndCheck<op>(res, ctx, &op_site);
+#else
+#define APPLYOP(a, b, res, op)                                                 \
+  ifcd_op_site_t op_site = {Null, false};                                      \
+  ifcd_profile<op>(a, b, decltype(a)(0), *res, ctx, &op_site);                 \
+  ifcd_shadow<op>(a, b, decltype(a)(0), *res, ctx, &op_site);                  \
+  ifcd_record<op>(a, b, decltype(a)(0), *res, ctx, &op_site);                  \
+  flushToZeroAndCheck<op>(res, ctx, &op_site);
+#endif
+
+void INTERFLOP_CHECKDENORMAL_API(add_double)(double a, double b, double *res,
+                                             void *context) {
+  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
+  APPLYOP(a, b, res, IFCD_OP_ADD);
+}
+
+void INTERFLOP_CHECKDENORMAL_API(add_float)(float a, float b, float *res,
+                                            void *context) {
+  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
+  APPLYOP(a, b, res, IFCD_OP_ADD);
+}
+
+void INTERFLOP_CHECKDENORMAL_API(sub_double)(double a, double b, double *res,
+                                             void *context) {
+  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
+  APPLYOP(a, b, res, IFCD_OP_SUB);
+}
+
+void INTERFLOP_CHECKDENORMAL_API(sub_float)(float a, float b, float *res,
+                                            void *context) {
+  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
+  APPLYOP(a, b, res, IFCD_OP_SUB);
+}
+
+void INTERFLOP_CHECKDENORMAL_API(mul_double)(double a, double b, double *res,
+                                             void *context) {
+  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
+  APPLYOP(a, b, res, IFCD_OP_MUL);
+}
+
+void INTERFLOP_CHECKDENORMAL_API(mul_float)(float a, float b, float *res,
+                                            void *context) {
+  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
+  APPLYOP(a, b, res, IFCD_OP_MUL);
+}
+
+void INTERFLOP_CHECKDENORMAL_API(div_double)(double a, double b, double *res,
+                                             void *context) {
+  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
+  APPLYOP(a, b, res, IFCD_OP_DIV);
+}
+
+void INTERFLOP_CHECKDENORMAL_API(div_float)(float a, float b, float *res,
+                                            void *context) {
+  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
+  APPLYOP(a, b, res, IFCD_OP_DIV);
+}
+
+void INTERFLOP_CHECKDENORMAL_API(fma_float)(float a, float b, float c,
+                                            float *res, void *context) {
+#ifdef IFCD_DOOP
+  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
+  ifcd_op_site_t op_site = {Null, false};
+  *res = ifcd_doop<IFCD_OP_FMA>(a, b, c, ctx, &op_site);
+  ifcd_profile<IFCD_OP_FMA>(a, b, c, *res, ctx, &op_site);
+  ifcd_shadow<IFCD_OP_FMA>(a, b, c, *res, ctx, &op_site);
+  ifcd_record<IFCD_OP_FMA>(a, b, c, *res, ctx, &op_site);
+  flushToZeroAndCheck<IFCD_OP_FMA>(res, ctx, &op_site);
+#endif
+}
+
+void INTERFLOP_CHECKDENORMAL_API(fma_double)(double a, double b, double c,
+                                             double *res, void *context) {
+#ifdef IFCD_DOOP
+  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
+  ifcd_op_site_t op_site = {Null, false};
+  *res = ifcd_doop<IFCD_OP_FMA>(a, b, c, ctx, &op_site);
+  ifcd_profile<IFCD_OP_FMA>(a, b, c, *res, ctx, &op_site);
+  ifcd_shadow<IFCD_OP_FMA>(a, b, c, *res, ctx, &op_site);
+  ifcd_record<IFCD_OP_FMA>(a, b, c, *res, ctx, &op_site);
+  flushToZeroAndCheck<IFCD_OP_FMA>(res, ctx, &op_site);
+#endif
+}
+
+void INTERFLOP_CHECKDENORMAL_API(cast_double_to_float)(double a, float *res,
+                                                       void *context) {
+  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
+  ifcd_op_site_t op_site = {Null, false};
+#ifdef IFCD_DOOP
+  *res = ifcd_doop<IFCD_OP_CAST, double, float>(a, 0, 0, ctx, &op_site);
+#endif
+  ifcd_profile<IFCD_OP_CAST, double, float>(a, 0, 0, *res, ctx, &op_site);
+  ifcd_shadow<IFCD_OP_CAST, double, float>(a, 0, 0, *res, ctx, &op_site);
+  ifcd_record<IFCD_OP_CAST, double, float>(a, 0, 0, *res, ctx, &op_site);
+  flushToZeroAndCheck<IFCD_OP_CAST>(res, ctx, &op_site);
+}
+
+// * Report
+
+static void ifcd_histogram_merge(ifcd_histogram_t dst,
+                                 const ifcd_histogram_t src) {
+  for (int i = 0; i < IFCD_LATENCY_BUCKETS; i++) {
+    dst[i] += ifcd_counter_read(&src[i]);
+  }
+}
+
+static uint64_t ifcd_histogram_total(const ifcd_histogram_t h) {
+  uint64_t total = 0;
+  for (int i = 0; i < IFCD_LATENCY_BUCKETS; i++) {
+    total += h[i];
+  }
+  return total;
+}
+
+/* Upper bound, in cycles, of the bucket holding quantile q */
+static uint64_t ifcd_histogram_quantile(const ifcd_histogram_t h, double q) {
+  uint64_t total = ifcd_histogram_total(h);
+  uint64_t rank = (uint64_t)std::ceil(q * total);
+  uint64_t seen = 0;
+  for (int i = 0; i < IFCD_LATENCY_BUCKETS; i++) {
+    seen += h[i];
+    if (seen >= rank && seen != 0) {
+      return (uint64_t)1 << i;
+    }
+  }
+  return (uint64_t)1 << (IFCD_LATENCY_BUCKETS - 1);
+}
+
+static void ifcd_histogram_print(File *out, const ifcd_histogram_t h) {
+  interflop_fprintf(out, " samples=%lu p50<%lu p90<%lu p99<%lu hist=",
+                    ifcd_histogram_total(h), ifcd_histogram_quantile(h, 0.5),
+                    ifcd_histogram_quantile(h, 0.9),
+                    ifcd_histogram_quantile(h, 0.99));
+  const char *sep = "";
+  for (int i = 0; i < IFCD_LATENCY_BUCKETS; i++) {
+    if (h[i] != 0) {
+      interflop_fprintf(out, "%s%d:%lu", sep, i, h[i]);
+      sep = ",";
+    }
+  }
+  interflop_fprintf(out, "\n");
+}
+
+/* Print addr as module+offset (symbol) so that it is stable across runs */
+static void ifcd_site_print(File *out, void *addr) {
+  Dl_info info;
+  if (addr == Null || dladdr(addr, &info) == 0 || info.dli_fname == Null) {
+    interflop_fprintf(out, "%p", addr);
+    return;
+  }
+  const char *module = info.dli_fname;
+  for (const char *p = info.dli_fname; *p != '\0'; p++) {
+    if (*p == '/') {
+      module = p + 1;
+    }
+  }
+  interflop_fprintf(out, "%s+0x%lx(%s)", module,
+                    (uintptr_t)addr - (uintptr_t)info.dli_fbase,
+                    info.dli_sname ? info.dli_sname : "??");
+}
+
+static void ifcd_site_table_merge(ifcd_site_table_t *dst,
+                                  ifcd_site_table_t *src) {
+  for (int i = 0; i < IFCD_SITE_TABLE_SIZE; i++) {
+    ifcd_site_t *from = &src->sites[i];
+    void *addr = __atomic_load_n(&from->addr, __ATOMIC_ACQUIRE);
+    if (addr == Null) {
+      continue;
+    }
+    ifcd_site_t *to = ifcd_site_lookup(dst, addr);
+    if (to == Null) {
+      continue;
+    }
+    for (int cls = 0; cls < IFCD_CLASS_END; cls++) {
+      ifcd_histogram_merge(to->latency[cls], from->latency[cls]);
+    }
+    for (int bin = 0; bin < IFCD_RESCALE_BINS; bin++) {
+      to->exponents[bin] += ifcd_counter_read(&from->exponents[bin]);
+    }
+    to->headroom = std::min(
+        to->headroom, __atomic_load_n(&from->headroom, __ATOMIC_RELAXED));
+    for (int outcome = 0; outcome < IFCD_SHADOW_END; outcome++) {
+      to->shadow[outcome] += ifcd_counter_read(&from->shadow[outcome]);
+    }
+  }
+  dst->dropped += ifcd_counter_read(&src->dropped);
+}
+
+static void ifcd_boundary_table_merge(ifcd_boundary_table_t *dst,
+                                      ifcd_boundary_table_t *src) {
+  for (int i = 0; i < IFCD_FUNCTION_TABLE_SIZE; i++) {
+    ifcd_boundary_t *from = &src->functions[i];
+    interflop_function_info_t *info =
+        __atomic_load_n(&from->info, __ATOMIC_ACQUIRE);
+    if (info == Null) {
+      continue;
+    }
+    ifcd_boundary_t *to = ifcd_boundary_lookup(dst, info);
+    if (to == Null) {
+      continue;
+    }
+    to->calls += ifcd_counter_read(&from->calls);
+    for (int direction = 0; direction < IFCD_DIRECTION_END; direction++) {
+      for (int pos = 0; pos < IFCD_MAX_ARGS; pos++) {
+        ifcd_arg_t *arg = &from->args[direction][pos];
+        to->args[direction][pos].checked += ifcd_counter_read(&arg->checked);
+        to->args[direction][pos].denormal +=
+            ifcd_counter_read(&arg->denormal);
+      }
+    }
+  }
+  dst->dropped += ifcd_counter_read(&src->dropped);
+}
 
-static const char backend_name[] = "interflop-checkdenormal";
-static const char backend_version[] = "1.x-dev";
+static void ifcd_context_table_merge(ifcd_context_table_t *dst,
+                                     ifcd_context_table_t *src) {
+  for (int i = 0; i < IFCD_CONTEXT_TABLE_SIZE; i++) {
+    ifcd_context_t *from = &src->contexts[i];
+    void *site = __atomic_load_n(&from->site, __ATOMIC_ACQUIRE);
+    if (site == Null) {
+      continue;
+    }
+    ifcd_context_t *to = ifcd_context_lookup(dst, site, from->hash);
+    if (to == Null) {
+      continue;
+    }
+    if (to->site == Null) {
+      /* hash and frames were published with the site */
+      to->site = site;
+      to->hash = from->hash;
+      to->nb_frames = from->nb_frames;
+      std::copy(from->frames, from->frames + from->nb_frames, to->frames);
+    }
+    to->denormals += ifcd_counter_read(&from->denormals);
+  }
+  dst->dropped += ifcd_counter_read(&src->dropped);
+}
 
-typedef enum { KEY_FTZ } key_args;
+static void ifcd_thread_merge(ifcd_thread_t *dst, ifcd_thread_t *src) {
+  for (int op = 0; op < IFCD_OP_END; op++) {
+    for (int type = 0; type < IFCD_TYPE_END; type++) {
+      for (int cls = 0; cls < IFCD_CLASS_END; cls++) {
+        ifcd_histogram_merge(dst->latency[op][type][cls],
+                             src->latency[op][type][cls]);
+      }
+    }
+  }
+  for (int op = 0; op < IFCD_OP_END; op++) {
+    for (int outcome = 0; outcome < IFCD_SHADOW_END; outcome++) {
+      dst->shadow[op][outcome] +=
+          ifcd_counter_read(&src->shadow[op][outcome]);
+    }
+  }
+  ifcd_site_table_merge(&dst->site_table, &src->site_table);
+  ifcd_boundary_table_merge(&dst->boundary_table, &src->boundary_table);
+  ifcd_context_table_merge(&dst->context_table, &src->context_table);
+}
 
-static const char key_ftz_str[] = "flush-to-zero";
+static void ifcd_report_latency(File *out, checkdenormal_context_t *ctx,
+                                ifcd_thread_t *all) {
+  interflop_fprintf(out,
+                    "# latency in cycles of 1 native operation out of %u "
+                    "on average, bucket k holds [2^(k-1), 2^k)\n",
+                    ctx->latency_sampling);
+  for (int op = 0; op < IFCD_OP_END; op++) {
+    for (int type = 0; type < IFCD_TYPE_END; type++) {
+      for (int cls = 0; cls < IFCD_CLASS_END; cls++) {
+        const uint64_t *h = all->latency[op][type][cls];
+        if (ifcd_histogram_total(h) == 0) {
+          continue;
+        }
+        interflop_fprintf(out, "latency %s_%s %s", ifcd_op_name[op],
+                          ifcd_type_name[type], ifcd_class_name[cls]);
+        ifcd_histogram_print(out, h);
+      }
+    }
+  }
 
-static File *stderr_stream;
+  /* Sites ordered by number of denormal samples */
+  ifcd_site_t *sites[IFCD_SITE_TABLE_SIZE];
+  int nb_sites = 0;
+  for (int i = 0; i < IFCD_SITE_TABLE_SIZE; i++) {
+    if (all->site_table.sites[i].addr != Null) {
+      sites[nb_sites++] = &all->site_table.sites[i];
+    }
+  }
+  std::sort(sites, sites + nb_sites, [](ifcd_site_t *x, ifcd_site_t *y) {
+    return ifcd_histogram_total(x->latency[IFCD_DENORMAL]) >
+           ifcd_histogram_total(y->latency[IFCD_DENORMAL]);
+  });
+  for (int i = 0; i < nb_sites; i++) {
+    for (int cls = 0; cls < IFCD_CLASS_END; cls++) {
+      if (ifcd_histogram_total(sites[i]->latency[cls]) == 0) {
+        continue;
+      }
+      interflop_fprintf(out, "site_latency ");
+      ifcd_site_print(out, sites[i]->addr);
+      interflop_fprintf(out, " %s", ifcd_class_name[cls]);
+      ifcd_histogram_print(out, sites[i]->latency[cls]);
+    }
+  }
+  if (all->site_table.dropped != 0) {
+    interflop_fprintf(out, "# %lu samples from untracked sites\n",
+                      all->site_table.dropped);
+  }
+}
 
-template <typename REAL>
-void ifcd_checkdenorm(const REAL &a, const REAL &b, const REAL &r);
+/* Smallest k such that scaling by 2^k moves all but IFCD_RESCALE_QUANTILE */
+/* of the values out of the subnormal range, -1 if beyond the window */
+static int ifcd_rescale_scale(const uint64_t *exponents) {
+  uint64_t total = 0;
+  for (int bin = 0; bin < IFCD_RESCALE_BINS; bin++) {
+    total += exponents[bin];
+  }
+  uint64_t rank = (uint64_t)(IFCD_RESCALE_QUANTILE * total);
+  uint64_t seen = 0;
+  for (int bin = 0; bin < IFCD_RESCALE_BINS; bin++) {
+    seen += exponents[bin];
+    if (seen > rank) {
+      return (bin == 0) ? -1 : IFCD_RESCALE_BINS - 1 - bin;
+    }
+  }
+  return 0;
+}
 
-template <class REAL>
-void flushToZeroAndCheck(REAL *res, checkdenormal_context_t *ctx) {
-  if (std::abs(*res) < std::numeric_limits<REAL>::min() && *res != 0.) {
-    if (interflop_denormalHandler != Null) {
-      interflop_denormalHandler();
+static void ifcd_rescale_print(File *out, const char *kind, void *addr,
+                               const uint64_t *exponents, int headroom) {
+  uint64_t values = 0, subnormal = 0;
+  for (int bin = 0; bin < IFCD_RESCALE_BINS; bin++) {
+    values += exponents[bin];
+  }
+  subnormal = values - exponents[IFCD_RESCALE_BINS - 1];
+  if (subnormal == 0) {
+    return;
+  }
+  int scale = ifcd_rescale_scale(exponents);
+  interflop_fprintf(out, "%s ", kind);
+  ifcd_site_print(out, addr);
+  interflop_fprintf(out, " values=%lu subnormal=%lu ", values, subnormal);
+  if (scale < 0) {
+    interflop_fprintf(out, "scale>2^%d headroom=%d beyond-window\n",
+                      IFCD_RESCALE_WINDOW, headroom);
+  } else if (scale > headroom) {
+    interflop_fprintf(out, "scale=2^%d headroom=%d overflow\n", scale,
+                      headroom);
+  } else {
+    interflop_fprintf(out, "scale=2^%d headroom=%d ok\n", scale, headroom);
+  }
+}
+
+typedef struct ifcd_function {
+  void *addr;
+  ifcd_site_t *site;
+} ifcd_function_t;
+
+static void ifcd_report_rescale(File *out, checkdenormal_context_t *ctx,
+                                ifcd_thread_t *all) {
+  interflop_fprintf(out,
+                    "# rescaling: smallest 2^k moving %g%% of the values "
+                    "out of the subnormal range, sampled 1 out of %u\n",
+                    100 * (1 - IFCD_RESCALE_QUANTILE), ctx->rescale_sampling);
+
+  /* Sites sorted by enclosing function so that functions are contiguous */
+  ifcd_function_t functions[IFCD_SITE_TABLE_SIZE];
+  int nb_sites = 0;
+  for (int i = 0; i < IFCD_SITE_TABLE_SIZE; i++) {
+    ifcd_site_t *site = &all->site_table.sites[i];
+    if (site->addr == Null) {
+      continue;
     }
-    if (ctx->flushtozero) {
-      *res = 0.;
+    Dl_info info;
+    bool found = dladdr(site->addr, &info) != 0 && info.dli_saddr != Null;
+    functions[nb_sites].addr = found ? info.dli_saddr : site->addr;
+    functions[nb_sites].site = site;
+    nb_sites++;
+    ifcd_rescale_print(out, "rescale", site->addr, site->exponents,
+                       site->headroom);
+  }
+  std::sort(functions, functions + nb_sites,
+            [](const ifcd_function_t &x, const ifcd_function_t &y) {
+              return x.addr < y.addr;
+            });
+
+  uint64_t exponents[IFCD_RESCALE_BINS];
+  for (int first = 0, last = 0; first < nb_sites; first = last) {
+    int headroom = INT_MAX;
+    for (int bin = 0; bin < IFCD_RESCALE_BINS; bin++) {
+      exponents[bin] = 0;
     }
+    for (last = first;
+         last < nb_sites && functions[last].addr == functions[first].addr;
+         last++) {
+      for (int bin = 0; bin < IFCD_RESCALE_BINS; bin++) {
+        exponents[bin] += functions[last].site->exponents[bin];
+      }
+      headroom = std::min(headroom, functions[last].site->headroom);
+    }
+    ifcd_rescale_print(out, "rescale_function", functions[first].addr,
+                       exponents, headroom);
   }
 }
 
-#if defined(__cplusplus)
-extern "C" {
-#endif
+static void ifcd_shadow_print(File *out, const uint64_t *shadow) {
+  for (int outcome = 0; outcome < IFCD_SHADOW_END; outcome++) {
+    interflop_fprintf(out, " %s=%lu", ifcd_shadow_name[outcome],
+                      shadow[outcome]);
+  }
+  bool range = shadow[IFCD_SHADOW_RANGE] >=
+               shadow[IFCD_SHADOW_TINY] + shadow[IFCD_SHADOW_ZERO];
+  interflop_fprintf(out, " %s\n", range ? "rescale" : "algorithm");
+}
 
-// * C interface
+static void ifcd_report_shadow(File *out, ifcd_thread_t *all) {
+  interflop_fprintf(out, "# double operations producing denormals or "
+                         "underflowing, re-evaluated in long double\n");
+  for (int op = 0; op < IFCD_OP_END; op++) {
+    uint64_t total = 0;
+    for (int outcome = 0; outcome < IFCD_SHADOW_END; outcome++) {
+      total += all->shadow[op][outcome];
+    }
+    if (total == 0) {
+      continue;
+    }
+    interflop_fprintf(out, "shadow %s_double", ifcd_op_name[op]);
+    ifcd_shadow_print(out, all->shadow[op]);
+  }
+  for (int i = 0; i < IFCD_SITE_TABLE_SIZE; i++) {
+    ifcd_site_t *site = &all->site_table.sites[i];
+    uint64_t total = 0;
+    for (int outcome = 0; outcome < IFCD_SHADOW_END; outcome++) {
+      total += site->shadow[outcome];
+    }
+    if (site->addr == Null || total == 0) {
+      continue;
+    }
+    interflop_fprintf(out, "shadow_site ");
+    ifcd_site_print(out, site->addr);
+    ifcd_shadow_print(out, site->shadow);
+  }
+}
 
-static void _set_checkdenormal_ftz(bool ftz, checkdenormal_context_t *ctx) {
-  ctx->flushtozero = ftz;
+static File *ifcd_report_open(const char *path) {
+  if (path == Null) {
+    return stderr_stream;
+  }
+  int error = 0;
+  File *out = interflop_fopen(path, "w", &error);
+  if (out == Null) {
+    logger_error("cannot open report file %s: %s\n", path,
+                 interflop_strerror(error));
+  }
+  return out;
 }
 
-#ifdef IFCD_DOOP
-#define APPLYOP(a, b, res, op)                                                 \
-  *res = a op b;                                                               \
-  flushToZeroAndCheck(res, ctx);
-#else
-#define APPLYOP(a, b, res, op) flushToZeroAndCheck(res, ctx);
-#endif
+static void ifcd_report_close(const char *path, File *out) {
+  if (path != Null) {
+    interflop_fclose(out);
+  }
+}
 
-void INTERFLOP_CHECKDENORMAL_API(add_double)(double a, double b, double *res,
-                                             void *context) {
-  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
-  APPLYOP(a, b, res, +);
+// * Function boundary hooks
+
+/* Check the float and double values passed by Verificarlo for each       */
+/* argument as (type, size, pointer): pointer to the scalar for FFLOAT and */
+/* FDOUBLE, to an array of size elements for FFLOAT_PTR and FDOUBLE_PTR.  */
+static void ifcd_boundary_inspect(interflop_function_stack_t *stack,
+                                  ifcd_direction_t direction, int nb_args,
+                                  va_list ap) {
+  if (stack == Null || stack->top < 0) {
+    return;
+  }
+  ifcd_thread_t *th = ifcd_thread();
+  ifcd_boundary_t *function =
+      ifcd_boundary_lookup(&th->boundary_table, stack->array[stack->top]);
+  if (function == Null) {
+    return;
+  }
+  if (direction == IFCD_ARG_IN) {
+    ifcd_counter_add(&function->calls, 1);
+  }
+  for (int i = 0; i < nb_args; i++) {
+    int type = va_arg(ap, int);
+    unsigned int size = va_arg(ap, unsigned int);
+    void *value = va_arg(ap, void *);
+    ifcd_arg_t *arg =
+        &function->args[direction][std::min(i, IFCD_MAX_ARGS - 1)];
+    if (value == Null) {
+      continue;
+    }
+    switch (type) {
+    case FFLOAT:
+      ifcd_boundary_check(arg, (float *)value, 1);
+      break;
+    case FDOUBLE:
+      ifcd_boundary_check(arg, (double *)value, 1);
+      break;
+    case FFLOAT_PTR:
+      ifcd_boundary_check(arg, (float *)value, size);
+      break;
+    case FDOUBLE_PTR:
+      ifcd_boundary_check(arg, (double *)value, size);
+      break;
+    default:
+      break;
+    }
+  }
 }
 
-void INTERFLOP_CHECKDENORMAL_API(add_float)(float a, float b, float *res,
-                                            void *context) {
-  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
-  APPLYOP(a, b, res, +);
+/* The calling-context hash at depth d of the frontend stack chains the */
+/* functions entered at depths 1..d. Hashes are indexed by the depth of  */
+/* the stack so that an unbalanced exit cannot shift every later context. */
+static void ifcd_context_enter(interflop_function_stack_t *stack) {
+  if (stack == Null || stack->top < 0) {
+    return;
+  }
+  ifcd_thread_t *th = ifcd_thread();
+  long depth = stack->top + 1;
+  if (depth <= IFCD_CONTEXT_DEPTH) {
+    uint64_t function = ifcd_hash_ptr(stack->array[stack->top]);
+    th->context_hashes[depth] =
+        (th->context_hashes[depth - 1] ^ function) * 0x100000001B3ULL;
+  }
+  th->context_hash =
+      th->context_hashes[std::min(depth, (long)IFCD_CONTEXT_DEPTH)];
 }
 
-void INTERFLOP_CHECKDENORMAL_API(sub_double)(double a, double b, double *res,
-                                             void *context) {
-  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
-  APPLYOP(a, b, res, -);
+static void ifcd_context_exit(interflop_function_stack_t *stack) {
+  if (stack == Null || stack->top < 0) {
+    return;
+  }
+  ifcd_thread_t *th = ifcd_thread();
+  th->context_hash =
+      th->context_hashes[std::min(stack->top, (long)IFCD_CONTEXT_DEPTH)];
 }
 
-void INTERFLOP_CHECKDENORMAL_API(sub_float)(float a, float b, float *res,
-                                            void *context) {
+void INTERFLOP_CHECKDENORMAL_API(enter_function)(
+    interflop_function_stack_t *stack, void *context, int nb_args,
+    va_list ap) {
   checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
-  APPLYOP(a, b, res, -);
+  if (ctx->calling_context) {
+    ifcd_context_enter(stack);
+  }
+  if (ctx->function_boundaries) {
+    ifcd_boundary_inspect(stack, IFCD_ARG_IN, nb_args, ap);
+  }
 }
 
-void INTERFLOP_CHECKDENORMAL_API(mul_double)(double a, double b, double *res,
-                                             void *context) {
+void INTERFLOP_CHECKDENORMAL_API(exit_function)(
+    interflop_function_stack_t *stack, void *context, int nb_args,
+    va_list ap) {
   checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
-  APPLYOP(a, b, res, *);
+  if (ctx->function_boundaries) {
+    ifcd_boundary_inspect(stack, IFCD_ARG_OUT, nb_args, ap);
+  }
+  if (ctx->calling_context) {
+    ifcd_context_exit(stack);
+  }
 }
 
-void INTERFLOP_CHECKDENORMAL_API(mul_float)(float a, float b, float *res,
-                                            void *context) {
-  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
-  APPLYOP(a, b, res, *);
+static uint64_t ifcd_boundary_denormals(const ifcd_boundary_t *function) {
+  uint64_t denormal = 0;
+  for (int direction = 0; direction < IFCD_DIRECTION_END; direction++) {
+    for (int i = 0; i < IFCD_MAX_ARGS; i++) {
+      denormal += function->args[direction][i].denormal;
+    }
+  }
+  return denormal;
 }
 
-void INTERFLOP_CHECKDENORMAL_API(div_double)(double a, double b, double *res,
-                                             void *context) {
-  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
-  APPLYOP(a, b, res, /);
+static void ifcd_report_boundaries(File *out, ifcd_thread_t *all) {
+  interflop_fprintf(out, "# denormal function arguments (arg) and return "
+                         "values (ret) as position:denormal/checked\n");
+  ifcd_boundary_t *functions[IFCD_FUNCTION_TABLE_SIZE];
+  int nb_functions = 0;
+  for (int i = 0; i < IFCD_FUNCTION_TABLE_SIZE; i++) {
+    ifcd_boundary_t *function = &all->boundary_table.functions[i];
+    if (function->info != Null && ifcd_boundary_denormals(function) != 0) {
+      functions[nb_functions++] = function;
+    }
+  }
+  std::sort(functions, functions + nb_functions,
+            [](ifcd_boundary_t *x, ifcd_boundary_t *y) {
+              return ifcd_boundary_denormals(x) > ifcd_boundary_denormals(y);
+            });
+  for (int i = 0; i < nb_functions; i++) {
+    ifcd_boundary_t *function = functions[i];
+    interflop_fprintf(out, "boundary %s calls=%lu",
+                      function->info->id ? function->info->id : "??",
+                      function->calls);
+    for (int direction = 0; direction < IFCD_DIRECTION_END; direction++) {
+      for (int pos = 0; pos < IFCD_MAX_ARGS; pos++) {
+        ifcd_arg_t *arg = &function->args[direction][pos];
+        if (arg->denormal != 0) {
+          interflop_fprintf(out, " %s%d:%lu/%lu",
+                            ifcd_direction_name[direction], pos,
+                            arg->denormal, arg->checked);
+        }
+      }
+    }
+    interflop_fprintf(out, "\n");
+  }
+  if (all->boundary_table.dropped != 0) {
+    interflop_fprintf(out, "# %lu calls to untracked functions\n",
+                      all->boundary_table.dropped);
+  }
 }
 
-void INTERFLOP_CHECKDENORMAL_API(div_float)(float a, float b, float *res,
-                                            void *context) {
-  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
-  APPLYOP(a, b, res, /);
+static void ifcd_report_contexts(File *out, ifcd_thread_t *all) {
+  interflop_fprintf(out, "# denormal results per call site and calling "
+                         "context, with the stack of the first one\n");
+  ifcd_context_t *contexts[IFCD_CONTEXT_TABLE_SIZE];
+  int nb_contexts = 0;
+  for (int i = 0; i < IFCD_CONTEXT_TABLE_SIZE; i++) {
+    if (all->context_table.contexts[i].site != Null) {
+      contexts[nb_contexts++] = &all->context_table.contexts[i];
+    }
+  }
+  std::sort(contexts, contexts + nb_contexts,
+            [](ifcd_context_t *x, ifcd_context_t *y) {
+              return x->denormals > y->denormals;
+            });
+  for (int i = 0; i < nb_contexts; i++) {
+    ifcd_context_t *context = contexts[i];
+    interflop_fprintf(out, "context ");
+    ifcd_site_print(out, context->site);
+    interflop_fprintf(out, " hash=0x%016lx denormals=%lu stack=",
+                      context->hash, context->denormals);
+    for (int k = 1; k < context->nb_frames; k++) {
+      ifcd_site_print(out, context->frames[k]);
+      interflop_fprintf(out, k + 1 < context->nb_frames ? "," : "");
+    }
+    interflop_fprintf(out, "\n");
+  }
+  if (all->context_table.dropped != 0) {
+    interflop_fprintf(out, "# %lu events from untracked contexts\n",
+                      all->context_table.dropped);
+  }
 }
 
-void INTERFLOP_CHECKDENORMAL_API(fma_float)(float a, float b, float c,
-                                            float *res, void *context) {
-#ifdef IFCD_DOOP
-  *res = interflop_fma_binary32(a, b, c);
-  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
-  flushToZeroAndCheck(res, ctx);
-#endif
+#if IFCD_HAS_WATCH
+static void ifcd_watch_print(File *out, const char *name,
+                             const ifcd_watch_capture_t *capture) {
+  interflop_fprintf(out, "watch %s[%lu] tid=%d value=%g writer=", name,
+                    capture->index, capture->tid, capture->value);
+  ifcd_site_print(out, capture->frames[0]);
+  interflop_fprintf(out, " stack=");
+  for (int k = 1; k < capture->nb_frames; k++) {
+    ifcd_site_print(out, capture->frames[k]);
+    interflop_fprintf(out, k + 1 < capture->nb_frames ? "," : "");
+  }
+  interflop_fprintf(out, "\n");
 }
 
-void INTERFLOP_CHECKDENORMAL_API(fma_double)(double a, double b, double c,
-                                             double *res, void *context) {
-#ifdef IFCD_DOOP
-  *res = interflop_fma_binary64(a, b, c);
-  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
-  flushToZeroAndCheck(res, ctx);
+static void ifcd_report_watch(File *out) {
+  interflop_fprintf(out, "# writers of denormals to watched buffers, the "
+                         "writer is the instruction following the write\n");
+  pthread_mutex_lock(&ifcd_watch_lock);
+  for (int i = 0; i < ifcd_nb_watch_reports; i++) {
+    ifcd_watch_print(out, ifcd_watch_reports[i].name,
+                     &ifcd_watch_reports[i].capture);
+  }
+  for (int i = 0; i < ifcd_nb_watch_buffers; i++) {
+    ifcd_watch_buffer_t *buffer = &ifcd_watch_buffers[i];
+    for (unsigned int j = 0; j < buffer->nb_captures; j++) {
+      ifcd_watch_print(out, buffer->name, &buffer->captures[j]);
+    }
+  }
+  if (ifcd_watch_reports_dropped != 0) {
+    interflop_fprintf(out, "# %lu writers of unregistered buffers dropped\n",
+                      ifcd_watch_reports_dropped);
+  }
+  pthread_mutex_unlock(&ifcd_watch_lock);
+}
+#else
+static void ifcd_report_watch(File *) {}
 #endif
+
+static void ifcd_report_counts(File *out) {
+  interflop_fprintf(out, "# denormal results per operation\n");
+  ifcd_metrics_t metrics;
+  ifcd_metrics_collect(&metrics);
+  for (int op = 0; op < IFCD_OP_END; op++) {
+    for (int type = 0; type < IFCD_TYPE_END; type++) {
+      if (metrics.operations[op][type] != 0) {
+        interflop_fprintf(out, "count %s %s denormals=%lu operations=%lu\n",
+                          ifcd_op_name[op], ifcd_type_name[type],
+                          metrics.denormals[op][type],
+                          metrics.operations[op][type]);
+      }
+    }
+  }
 }
 
-void INTERFLOP_CHECKDENORMAL_API(cast_double_to_float)(double a, float *res,
-                                                       void *context) {
-#ifdef IFCD_DOOP
-  *res = (float)a;
-#endif
+/* Merge every thread and write the enabled report sections to path, or to */
+/* the backend stream if path is NULL. Alert snapshots also get a title and */
+/* the counts per operation. */
+static void ifcd_report_write(checkdenormal_context_t *ctx, const char *path,
+                              const char *title) {
+  ifcd_thread_t *all =
+      (ifcd_thread_t *)interflop_calloc(1, sizeof(ifcd_thread_t));
+  if (all == Null) {
+    logger_error("cannot allocate report\n");
+  }
+  for (ifcd_thread_t *th = __atomic_load_n(&ifcd_threads, __ATOMIC_ACQUIRE);
+       th != Null; th = th->next) {
+    ifcd_thread_merge(all, th);
+  }
+
+  File *out = ifcd_report_open(path);
+  if (title != Null) {
+    interflop_fprintf(out, "%s", title);
+    ifcd_report_counts(out);
+  }
+  if (ctx->latency_sampling != 0) {
+    ifcd_report_latency(out, ctx, all);
+  }
+  if (ctx->rescale_sampling != 0) {
+    ifcd_report_rescale(out, ctx, all);
+  }
+  if (ctx->extended_shadow) {
+    ifcd_report_shadow(out, all);
+  }
+  if (ctx->function_boundaries) {
+    ifcd_report_boundaries(out, all);
+  }
+  if (ctx->calling_context) {
+    ifcd_report_contexts(out, all);
+  }
+  if (ctx->watch != 0) {
+    ifcd_report_watch(out);
+  }
+  ifcd_report_close(path, out);
+  interflop_free(all);
+}
+
+// * Operand records output
+
+/* Write the samples of every thread as site,op,type,weight,a,b,c lines, */
+/* the weight being the operations represented by each sample */
+static void ifcd_record_write(checkdenormal_context_t *ctx) {
+  int error = 0;
+  File *out = interflop_fopen(ctx->record, "w", &error);
+  if (out == Null) {
+    logger_error("cannot open record file %s: %s\n", ctx->record,
+                 interflop_strerror(error));
+  }
+  interflop_fprintf(out, "# site,op,type,weight,a,b,c\n");
+  uint64_t dropped = 0;
+  for (ifcd_thread_t *th = __atomic_load_n(&ifcd_threads, __ATOMIC_ACQUIRE);
+       th != Null; th = th->next) {
+    ifcd_record_table_t *table =
+        __atomic_load_n(&th->record_table, __ATOMIC_ACQUIRE);
+    if (table == Null) {
+      continue;
+    }
+    for (int i = 0; i < IFCD_RECORD_SITES; i++) {
+      ifcd_record_site_t *site = &table->sites[i];
+      void *addr = __atomic_load_n(&site->addr, __ATOMIC_ACQUIRE);
+      uint64_t seen = __atomic_load_n(&site->seen, __ATOMIC_ACQUIRE);
+      if (addr == Null || seen == 0) {
+        continue;
+      }
+      uint64_t kept = std::min<uint64_t>(seen, IFCD_RECORD_SAMPLES);
+      for (uint64_t j = 0; j < kept; j++) {
+        ifcd_operands_t *sample = &site->samples[j];
+        double operands[3];
+        __atomic_load(&sample->a, &operands[0], __ATOMIC_RELAXED);
+        __atomic_load(&sample->b, &operands[1], __ATOMIC_RELAXED);
+        __atomic_load(&sample->c, &operands[2], __ATOMIC_RELAXED);
+        ifcd_site_print(out, addr);
+        interflop_fprintf(
+            out, ",%s,%s,%.17g,%a,%a,%a\n",
+            ifcd_op_name[__atomic_load_n(&sample->op, __ATOMIC_RELAXED)],
+            ifcd_type_name[__atomic_load_n(&sample->type, __ATOMIC_RELAXED)],
+            (double)seen / kept, operands[0], operands[1], operands[2]);
+      }
+    }
+    dropped += ifcd_counter_read(&table->dropped);
+  }
+  if (dropped != 0) {
+    interflop_fprintf(out, "# %lu operations from untracked sites\n",
+                      dropped);
+  }
+  interflop_fclose(out);
+}
+
+// * User calls
+
+void INTERFLOP_CHECKDENORMAL_API(user_call)(void *context, interflop_call_id id,
+                                            va_list ap) {
   checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
-  flushToZeroAndCheck(res, ctx);
+  /* calls with other ids are meant for the other loaded backends */
+  if (id != INTERFLOP_CUSTOM_ID) {
+    return;
+  }
+  int call = va_arg(ap, int);
+  switch (call) {
+  case CHECKDENORMAL_CALL_WATCH: {
+    const char *name = va_arg(ap, const char *);
+    void *buffer = va_arg(ap, void *);
+    size_t count = va_arg(ap, size_t);
+    int type = va_arg(ap, int);
+    if (ctx->watch != 0) {
+      ifcd_watch_register(name, buffer, count, type);
+    }
+    break;
+  }
+  case CHECKDENORMAL_CALL_UNWATCH:
+    if (ctx->watch != 0) {
+      ifcd_watch_unregister(va_arg(ap, void *));
+    }
+    break;
+  default:
+    logger_warning("unsupported interflop_user_call %d\n", call);
+  }
+}
+
+// * Heatmap output
+
+typedef struct ifcd_heatmap_row {
+  void *site;
+  uint64_t total;
+  uint64_t events[IFCD_HEATMAP_WINDOWS];
+} ifcd_heatmap_row_t;
+
+/* Merge every thread heatmap at the coarsest scale into rows, the last */
+/* row holding the sites that had no row of their own in some thread */
+static int ifcd_heatmap_merge(ifcd_heatmap_row_t *rows, int max_rows,
+                              unsigned int *scale) {
+  *scale = 0;
+  for (ifcd_thread_t *th = __atomic_load_n(&ifcd_threads, __ATOMIC_ACQUIRE);
+       th != Null; th = th->next) {
+    *scale = std::max(*scale,
+                      __atomic_load_n(&th->heatmap.scale, __ATOMIC_RELAXED));
+  }
+  int nb_rows = 0;
+  ifcd_heatmap_row_t *other = &rows[max_rows - 1];
+  for (ifcd_thread_t *th = __atomic_load_n(&ifcd_threads, __ATOMIC_ACQUIRE);
+       th != Null; th = th->next) {
+    ifcd_heatmap_t *heatmap = &th->heatmap;
+    /* A live thread may have coarsened its heatmap since the scale was read */
+    unsigned int shift =
+        *scale -
+        std::min(*scale, __atomic_load_n(&heatmap->scale, __ATOMIC_RELAXED));
+    for (int row = 0; row <= IFCD_HEATMAP_ROWS; row++) {
+      void *site =
+          (row < IFCD_HEATMAP_ROWS)
+              ? __atomic_load_n(&heatmap->sites[row], __ATOMIC_ACQUIRE)
+              : Null;
+      if (row < IFCD_HEATMAP_ROWS && site == Null) {
+        continue;
+      }
+      ifcd_heatmap_row_t *to = other;
+      if (site != Null) {
+        int i = 0;
+        while (i < nb_rows && rows[i].site != site) {
+          i++;
+        }
+        if (i == nb_rows && nb_rows < max_rows - 1) {
+          rows[nb_rows++].site = site;
+        }
+        if (i < nb_rows) {
+          to = &rows[i];
+        }
+      }
+      for (int w = 0; w < IFCD_HEATMAP_WINDOWS; w++) {
+        uint64_t events = ifcd_counter_read(&heatmap->events[row][w]);
+        to->events[w >> shift] += events;
+        to->total += events;
+      }
+    }
+  }
+  return nb_rows;
+}
+
+static File *ifcd_heatmap_open(checkdenormal_context_t *ctx,
+                               const char *suffix) {
+  char path[4096];
+  interflop_sprintf(path, "%.4000s%s", ctx->heatmap, suffix);
+  int error = 0;
+  File *out = interflop_fopen(path, "w", &error);
+  if (out == Null) {
+    logger_error("cannot open heatmap file %s: %s\n", path,
+                 interflop_strerror(error));
+  }
+  return out;
+}
+
+/* Write the top sites x time windows matrix as PREFIX.heatmap, one sparse */
+/* row of window:events per site, and as PREFIX.csv for plotting */
+static void ifcd_report_heatmap(checkdenormal_context_t *ctx) {
+  const int max_rows = IFCD_SITE_TABLE_SIZE;
+  ifcd_heatmap_row_t *rows = (ifcd_heatmap_row_t *)interflop_calloc(
+      max_rows, sizeof(ifcd_heatmap_row_t));
+  if (rows == Null) {
+    logger_error("cannot allocate heatmap\n");
+  }
+  unsigned int scale;
+  int nb_rows = ifcd_heatmap_merge(rows, max_rows, &scale);
+  ifcd_heatmap_row_t *other = &rows[max_rows - 1];
+
+  /* Keep the top sites and fold the others into the last row */
+  std::sort(rows, rows + nb_rows,
+            [](const ifcd_heatmap_row_t &x, const ifcd_heatmap_row_t &y) {
+              return x.total > y.total;
+            });
+  for (int i = IFCD_HEATMAP_TOP; i < nb_rows; i++) {
+    for (int w = 0; w < IFCD_HEATMAP_WINDOWS; w++) {
+      other->events[w] += rows[i].events[w];
+    }
+    other->total += rows[i].total;
+  }
+  nb_rows = std::min(nb_rows, IFCD_HEATMAP_TOP);
+  uint64_t window_ms = (uint64_t)ctx->heatmap_window << scale;
+
+  File *heatmap = ifcd_heatmap_open(ctx, ".heatmap");
+  File *csv = ifcd_heatmap_open(ctx, ".csv");
+  interflop_fprintf(heatmap, "# window_ms=%lu windows=%d\n", window_ms,
+                    IFCD_HEATMAP_WINDOWS);
+  interflop_fprintf(csv, "site,window,start_ms,events\n");
+  for (int i = 0; i <= nb_rows; i++) {
+    ifcd_heatmap_row_t *row = (i < nb_rows) ? &rows[i] : other;
+    if (row->total == 0) {
+      continue;
+    }
+    char name[512] = "other";
+    if (i < nb_rows) {
+      Dl_info info;
+      if (dladdr(row->site, &info) != 0 && info.dli_fname != Null) {
+        const char *module = info.dli_fname;
+        for (const char *p = info.dli_fname; *p != '\0'; p++) {
+          if (*p == '/') {
+            module = p + 1;
+          }
+        }
+        interflop_sprintf(name, "%.400s+0x%lx", module,
+                          (uintptr_t)row->site - (uintptr_t)info.dli_fbase);
+      } else {
+        interflop_sprintf(name, "%p", row->site);
+      }
+    }
+    interflop_fprintf(heatmap, "%s total=%lu", name, row->total);
+    for (int w = 0; w < IFCD_HEATMAP_WINDOWS; w++) {
+      if (row->events[w] != 0) {
+        interflop_fprintf(heatmap, " %d:%lu", w, row->events[w]);
+        interflop_fprintf(csv, "%s,%d,%lu,%lu\n", name, w, w * window_ms,
+                          row->events[w]);
+      }
+    }
+    interflop_fprintf(heatmap, "\n");
+  }
+  interflop_fclose(heatmap);
+  interflop_fclose(csv);
+  interflop_free(rows);
 }
 
-void INTERFLOP_CHECKDENORMAL_API(finalize)([[maybe_unused]] void *context) {}
+void INTERFLOP_CHECKDENORMAL_API(finalize)(void *context) {
+  checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
+  if (ctx->stream != Null) {
+    ifcd_stream_finish();
+  }
+  if (ctx->watch != 0) {
+    ifcd_watch_finish(ctx);
+  }
+  if (ctx->heatmap != Null) {
+    ifcd_report_heatmap(ctx);
+  }
+  if (ctx->metrics != Null) {
+    ifcd_metrics_write(ctx, true);
+  }
+  if (ctx->record != Null) {
+    ifcd_record_write(ctx);
+  }
+  if (ctx->latency_sampling == 0 && ctx->rescale_sampling == 0 &&
+      !ctx->extended_shadow && !ctx->function_boundaries &&
+      !ctx->calling_context && ctx->watch == 0) {
+    return;
+  }
+  ifcd_report_write(ctx, ctx->report_file, Null);
+}
 
 const char *INTERFLOP_CHECKDENORMAL_API(get_backend_name)() {
   return backend_name;
@@ -173,8 +3397,16 @@ const char *INTERFLOP_CHECKDENORMAL_API(get_backend_version)() {
 void _checkdenormal_check_stdlib(void) {
   INTERFLOP_CHECK_IMPL(denormalHandler);
   INTERFLOP_CHECK_IMPL(malloc);
+  INTERFLOP_CHECK_IMPL(calloc);
+  INTERFLOP_CHECK_IMPL(free);
+  INTERFLOP_CHECK_IMPL(fopen);
+  INTERFLOP_CHECK_IMPL(fclose);
+  INTERFLOP_CHECK_IMPL(fprintf);
+  INTERFLOP_CHECK_IMPL(strerror);
+  INTERFLOP_CHECK_IMPL(sprintf);
   INTERFLOP_CHECK_IMPL(strcasecmp);
   INTERFLOP_CHECK_IMPL(strtol);
+  INTERFLOP_CHECK_IMPL(strtod);
 }
 
 void _checkdenormal_alloc_context(void **context) {
@@ -184,6 +3416,23 @@ void _checkdenormal_alloc_context(void **context) {
 
 void _checkdenormal_init_context(checkdenormal_context_t *ctx) {
   ctx->flushtozero = IFalse;
+  ctx->latency_sampling = 0;
+  ctx->rescale_sampling = 0;
+  ctx->extended_shadow = IFalse;
+  ctx->function_boundaries = IFalse;
+  ctx->calling_context = IFalse;
+  ctx->heatmap = Null;
+  ctx->heatmap_window = IFCD_HEATMAP_WINDOW_MS;
+  ctx->metrics = Null;
+  ctx->metrics_interval = IFCD_METRICS_INTERVAL_S;
+  ctx->stream = Null;
+  ctx->record = Null;
+  ctx->flush_sites = Null;
+  ctx->watch = 0;
+  ctx->watch_interval = IFCD_WATCH_INTERVAL_MS;
+  ctx->nb_alerts = 0;
+  ctx->site_depth = IFCD_SITE_DEPTH;
+  ctx->report_file = Null;
 }
 
 void INTERFLOP_CHECKDENORMAL_API(pre_init)(interflop_panic_t panic,
@@ -203,7 +3452,154 @@ void INTERFLOP_CHECKDENORMAL_API(pre_init)(interflop_panic_t panic,
 static struct argp_option end_option = {0, 0, 0, 0, 0, 0};
 
 static struct argp_option options[] = {
-    {key_ftz_str, KEY_FTZ, "FTZ", 0, "enable flush-to-zero", 0}, end_option};
+    {key_ftz_str, KEY_FTZ, "FTZ", 0, "enable flush-to-zero", 0},
+    {key_latency_sampling_str, KEY_LATENCY_SAMPLING, "N", 0,
+     "time 1 native operation out of N with rdtsc (default 0, disabled)", 0},
+    {key_rescale_sampling_str, KEY_RESCALE_SAMPLING, "N", 0,
+     "record the exponents of 1 operation out of N per call site and "
+     "recommend power-of-two rescaling (default 0, disabled)",
+     0},
+    {key_extended_shadow_str, KEY_EXTENDED_SHADOW, 0, 0,
+     "re-evaluate double operations producing denormals in long double", 0},
+    {key_function_boundaries_str, KEY_FUNCTION_BOUNDARIES, 0, 0,
+     "check function arguments and return values for denormals", 0},
+    {key_calling_context_str, KEY_CALLING_CONTEXT, 0, 0,
+     "attribute denormal results to their call site and calling context, "
+     "tracked by the function instrumentation hooks",
+     0},
+    {key_heatmap_str, KEY_HEATMAP, "PREFIX", 0,
+     "write the denormal events per site and time window to "
+     "PREFIX.heatmap and PREFIX.csv",
+     0},
+    {key_heatmap_window_str, KEY_HEATMAP_WINDOW, "MS", 0,
+     "initial heatmap time window in milliseconds (default 100)", 0},
+    {key_metrics_str, KEY_METRICS, "FILE", 0,
+     "periodically write Prometheus metrics to FILE", 0},
+    {key_metrics_interval_str, KEY_METRICS_INTERVAL, "SECONDS", 0,
+     "metrics update period (default 10)", 0},
+    {key_stream_str, KEY_STREAM, "unix:PATH", 0,
+     "stream denormal events to the collector listening on the UNIX "
+     "socket PATH",
+     0},
+    {key_record_str, KEY_RECORD, "FILE", 0,
+     "write a sample of the operands of each site whose operations take a "
+     "denormal or underflow to FILE, for checkdenormal-whatif",
+     0},
+    {key_flush_sites_str, KEY_FLUSH_SITES, "FILE", 0,
+     "flush to zero only the denormal results of the module+0xoffset sites "
+     "listed in FILE, one per line",
+     0},
+    {key_watch_str, KEY_WATCH, "N", 0,
+     "capture with a hardware breakpoint up to N writers of denormals to each "
+     "buffer registered with interflop_user_call (default 0, disabled)",
+     0},
+    {key_watch_interval_str, KEY_WATCH_INTERVAL, "MS", 0,
+     "scan period of the watched buffers in milliseconds (default 100)", 0},
+    {key_alert_str, KEY_ALERT, "RULE", 0,
+     "run an action when the denormal rate of a thread exceeds a threshold "
+     "over a window, RULE is OP_TYPE>RATE[%]/WINDOW(ms|s):ACTION with OP, "
+     "TYPE possibly any and ACTION among log, report, trap and handler, "
+     "e.g. mul_double>1%/1s:log (repeatable)",
+     0},
+    {key_site_depth_str, KEY_SITE_DEPTH, "DEPTH", 0,
+     "frames between the backend and the reported call site (default 2)", 0},
+    {key_report_file_str, KEY_REPORT_FILE, "FILE", 0,
+     "write the finalize report to FILE instead of stderr", 0},
+    end_option};
+
+static unsigned int parse_uint(const char *arg, const char *key_str) {
+  char *endptr;
+  int error = 0;
+  long val = interflop_strtol(arg, &endptr, &error);
+  if (error != 0 || *endptr != '\0' || val < 0 || val > UINT32_MAX) {
+    logger_error("--%s invalid value provided, must be a non-negative "
+                 "integer\n",
+                 key_str);
+  }
+  return (unsigned int)val;
+}
+
+/* Index of name in names, or -1 for "any" */
+static int parse_name(const char *name, const char **names, int nb_names,
+                      const char *rule) {
+  if (interflop_strcasecmp(name, "any") == 0) {
+    return -1;
+  }
+  for (int i = 0; i < nb_names; i++) {
+    if (interflop_strcasecmp(name, names[i]) == 0) {
+      return i;
+    }
+  }
+  logger_error("--%s unknown name %s in %s\n", key_alert_str, name, rule);
+  return -1;
+}
+
+/* Parse OP_TYPE>THRESHOLD[%]/WINDOW(ms|s):ACTION, e.g. mul_double>1%/1s:log */
+static checkdenormal_alert_t parse_alert(const char *rule) {
+  checkdenormal_alert_t alert;
+  char op[16], type[16];
+  const char *p = rule;
+  int n = 0;
+  for (; *p != '_' && *p != '\0' && n < 15; p++) {
+    op[n++] = *p;
+  }
+  op[n] = '\0';
+  if (*p++ != '_') {
+    logger_error("--%s expected OP_TYPE in %s\n", key_alert_str, rule);
+  }
+  for (n = 0; *p != '>' && *p != '\0' && n < 15; p++) {
+    type[n++] = *p;
+  }
+  type[n] = '\0';
+  if (*p++ != '>') {
+    logger_error("--%s expected '>' in %s\n", key_alert_str, rule);
+  }
+  alert.op = parse_name(op, ifcd_op_name, IFCD_OP_END, rule);
+  alert.type = parse_name(type, ifcd_type_name, IFCD_TYPE_END, rule);
+
+  char *endptr;
+  int error = 0;
+  alert.threshold = interflop_strtod(p, &endptr, &error);
+  if (error != 0 || endptr == p || alert.threshold < 0) {
+    logger_error("--%s invalid threshold in %s\n", key_alert_str, rule);
+  }
+  if (*endptr == '%') {
+    alert.threshold /= 100;
+    endptr++;
+  }
+  if (*endptr != '/') {
+    logger_error("--%s expected '/' in %s\n", key_alert_str, rule);
+  }
+  p = endptr + 1;
+  long window = interflop_strtol(p, &endptr, &error);
+  if (error != 0 || endptr == p || window <= 0) {
+    logger_error("--%s invalid window in %s\n", key_alert_str, rule);
+  }
+  if (endptr[0] == 'm' && endptr[1] == 's') {
+    endptr += 2;
+  } else if (endptr[0] == 's') {
+    window *= 1000;
+    endptr += 1;
+  } else {
+    logger_error("--%s window unit must be ms or s in %s\n", key_alert_str,
+                 rule);
+  }
+  if (window > UINT32_MAX) {
+    logger_error("--%s window too long in %s\n", key_alert_str, rule);
+  }
+  alert.window_ms = (unsigned int)window;
+  if (*endptr != ':') {
+    logger_error("--%s expected ':' in %s\n", key_alert_str, rule);
+  }
+  int action = parse_name(endptr + 1, ifcd_alert_action_name,
+                          CHECKDENORMAL_ALERT_HANDLER + 1, rule);
+  if (action < 0) {
+    logger_error("--%s action must be log, report, trap or handler in %s\n",
+                 key_alert_str, rule);
+  }
+  alert.action = (checkdenormal_alert_action_t)action;
+  return alert;
+}
 
 static error_t parse_opt(int key, [[maybe_unused]] char *arg,
                          struct argp_state *state) {
@@ -213,6 +3609,81 @@ static error_t parse_opt(int key, [[maybe_unused]] char *arg,
     /* flust-to-zero */
     _set_checkdenormal_ftz(ITrue, ctx);
     break;
+  case KEY_LATENCY_SAMPLING:
+    /* latency sampling period */
+    _set_checkdenormal_latency_sampling(
+        parse_uint(arg, key_latency_sampling_str), ctx);
+    break;
+  case KEY_RESCALE_SAMPLING:
+    /* exponent sampling period */
+    _set_checkdenormal_rescale_sampling(
+        parse_uint(arg, key_rescale_sampling_str), ctx);
+    break;
+  case KEY_EXTENDED_SHADOW:
+    /* extended-exponent shadow evaluation */
+    _set_checkdenormal_extended_shadow(ITrue, ctx);
+    break;
+  case KEY_FUNCTION_BOUNDARIES:
+    /* function boundary inspection */
+    _set_checkdenormal_function_boundaries(ITrue, ctx);
+    break;
+  case KEY_CALLING_CONTEXT:
+    /* calling-context attribution */
+    _set_checkdenormal_calling_context(ITrue, ctx);
+    break;
+  case KEY_HEATMAP:
+    /* heatmap output prefix */
+    _set_checkdenormal_heatmap(arg, ctx);
+    break;
+  case KEY_HEATMAP_WINDOW:
+    /* heatmap time window */
+    _set_checkdenormal_heatmap_window(parse_uint(arg, key_heatmap_window_str),
+                                      ctx);
+    break;
+  case KEY_METRICS:
+    /* Prometheus metrics file */
+    _set_checkdenormal_metrics(arg, ctx);
+    break;
+  case KEY_METRICS_INTERVAL:
+    /* metrics update period */
+    _set_checkdenormal_metrics_interval(
+        parse_uint(arg, key_metrics_interval_str), ctx);
+    break;
+  case KEY_STREAM:
+    /* event stream socket */
+    _set_checkdenormal_stream(arg, ctx);
+    break;
+  case KEY_RECORD:
+    /* operand records file */
+    _set_checkdenormal_record(arg, ctx);
+    break;
+  case KEY_FLUSH_SITES:
+    /* sites flushed to zero */
+    _set_checkdenormal_flush_sites(arg, ctx);
+    break;
+  case KEY_WATCH:
+    /* writers captured per watched buffer */
+    _set_checkdenormal_watch(parse_uint(arg, key_watch_str), ctx);
+    break;
+  case KEY_WATCH_INTERVAL:
+    /* watched buffers scan period */
+    _set_checkdenormal_watch_interval(parse_uint(arg, key_watch_interval_str),
+                                      ctx);
+    break;
+  case KEY_ALERT: {
+    /* denormal-rate alert rule */
+    checkdenormal_alert_t alert = parse_alert(arg);
+    _set_checkdenormal_alert(&alert, ctx);
+    break;
+  }
+  case KEY_SITE_DEPTH:
+    /* call site depth */
+    _set_checkdenormal_site_depth(parse_uint(arg, key_site_depth_str), ctx);
+    break;
+  case KEY_REPORT_FILE:
+    /* report file */
+    _set_checkdenormal_report_file(arg, ctx);
+    break;
   default:
     return ARGP_ERR_UNKNOWN;
   }
@@ -235,7 +3706,32 @@ void INTERFLOP_CHECKDENORMAL_API(cli)(int argc, char **argv, void *context) {
 void INTERFLOP_CHECKDENORMAL_API(configure)(void *configure, void *context) {
   checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
   checkdenormal_conf_t *conf = (checkdenormal_conf_t *)configure;
-  ctx->flushtozero = conf->flushtozero;
+  _set_checkdenormal_ftz(conf->flushtozero, ctx);
+  _set_checkdenormal_latency_sampling(conf->latency_sampling, ctx);
+  _set_checkdenormal_rescale_sampling(conf->rescale_sampling, ctx);
+  _set_checkdenormal_extended_shadow(conf->extended_shadow, ctx);
+  _set_checkdenormal_function_boundaries(conf->function_boundaries, ctx);
+  _set_checkdenormal_calling_context(conf->calling_context, ctx);
+  _set_checkdenormal_heatmap(conf->heatmap, ctx);
+  _set_checkdenormal_heatmap_window(
+      conf->heatmap_window ? conf->heatmap_window : IFCD_HEATMAP_WINDOW_MS,
+      ctx);
+  _set_checkdenormal_metrics(conf->metrics, ctx);
+  _set_checkdenormal_metrics_interval(conf->metrics_interval
+                                          ? conf->metrics_interval
+                                          : IFCD_METRICS_INTERVAL_S,
+                                      ctx);
+  _set_checkdenormal_stream(conf->stream, ctx);
+  _set_checkdenormal_record(conf->record, ctx);
+  _set_checkdenormal_flush_sites(conf->flush_sites, ctx);
+  _set_checkdenormal_watch(conf->watch, ctx);
+  _set_checkdenormal_watch_interval(
+      conf->watch_interval ? conf->watch_interval : IFCD_WATCH_INTERVAL_MS,
+      ctx);
+  _set_checkdenormal_alerts(conf->alerts, conf->nb_alerts, ctx);
+  _set_checkdenormal_site_depth(
+      conf->site_depth ? conf->site_depth : IFCD_SITE_DEPTH, ctx);
+  _set_checkdenormal_report_file(conf->report_file, ctx);
 }
 
 static void print_information_header(void *context) {
@@ -252,6 +3748,36 @@ static void print_information_header(void *context) {
   checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
   logger_info("load backend with:\n");
   logger_info("%s = %s\n", key_ftz_str, ctx->flushtozero ? "true" : "false");
+  logger_info("%s = %u\n", key_latency_sampling_str, ctx->latency_sampling);
+  logger_info("%s = %u\n", key_rescale_sampling_str, ctx->rescale_sampling);
+  logger_info("%s = %s\n", key_extended_shadow_str,
+              ctx->extended_shadow ? "true" : "false");
+  logger_info("%s = %s\n", key_function_boundaries_str,
+              ctx->function_boundaries ? "true" : "false");
+  logger_info("%s = %s\n", key_calling_context_str,
+              ctx->calling_context ? "true" : "false");
+  logger_info("%s = %s\n", key_heatmap_str,
+              ctx->heatmap ? ctx->heatmap : "none");
+  logger_info("%s = %u\n", key_heatmap_window_str, ctx->heatmap_window);
+  logger_info("%s = %s\n", key_metrics_str,
+              ctx->metrics ? ctx->metrics : "none");
+  logger_info("%s = %u\n", key_metrics_interval_str, ctx->metrics_interval);
+  logger_info("%s = %s\n", key_stream_str,
+              ctx->stream ? ctx->stream : "none");
+  logger_info("%s = %s\n", key_record_str,
+              ctx->record ? ctx->record : "none");
+  logger_info("%s = %s\n", key_flush_sites_str,
+              ctx->flush_sites ? ctx->flush_sites : "none");
+  logger_info("%s = %u\n", key_watch_str, ctx->watch);
+  logger_info("%s = %u\n", key_watch_interval_str, ctx->watch_interval);
+  for (unsigned int i = 0; i < ctx->nb_alerts; i++) {
+    char rule[128];
+    ifcd_alert_format(rule, &ctx->alerts[i]);
+    logger_info("%s = %s\n", key_alert_str, rule);
+  }
+  logger_info("%s = %u\n", key_site_depth_str, ctx->site_depth);
+  logger_info("%s = %s\n", key_report_file_str,
+              ctx->report_file ? ctx->report_file : "stderr");
 }
 
 struct interflop_backend_interface_t
@@ -259,6 +3785,22 @@ INTERFLOP_CHECKDENORMAL_API(init)(void *context) {
 
   checkdenormal_context_t *ctx = (checkdenormal_context_t *)context;
   print_information_header(ctx);
+  /* only the options that required interflop_gettimeofday read the clock */
+  if (ctx->heatmap != Null || ctx->metrics != Null || ctx->stream != Null ||
+      ctx->nb_alerts != 0) {
+    ifcd_start_ns = ifcd_now_ns();
+    ifcd_metrics_deadline_ns =
+        ifcd_start_ns + (uint64_t)ctx->metrics_interval * 1000000000ULL;
+  }
+  if (ctx->stream != Null) {
+    ifcd_stream_start(ctx);
+  }
+  if (ctx->watch != 0) {
+    ifcd_watch_start(ctx);
+  }
+  if (ctx->flush_sites != Null) {
+    ifcd_flush_sites_load(ctx);
+  }
 
   struct interflop_backend_interface_t interflop_backend_checkdenormal = {
     interflop_add_float : INTERFLOP_CHECKDENORMAL_API(add_float),
@@ -275,9 +3817,17 @@ INTERFLOP_CHECKDENORMAL_API(init)(void *context) {
         INTERFLOP_CHECKDENORMAL_API(cast_double_to_float),
     interflop_fma_float : INTERFLOP_CHECKDENORMAL_API(fma_float),
     interflop_fma_double : INTERFLOP_CHECKDENORMAL_API(fma_double),
-    interflop_enter_function : Null,
-    interflop_exit_function : Null,
-    interflop_user_call : Null,
+    interflop_enter_function : (ctx->function_boundaries ||
+                                ctx->calling_context)
+        ? INTERFLOP_CHECKDENORMAL_API(enter_function)
+        : Null,
+    interflop_exit_function : (ctx->function_boundaries ||
+                               ctx->calling_context)
+        ? INTERFLOP_CHECKDENORMAL_API(exit_function)
+        : Null,
+    interflop_user_call : (ctx->watch != 0)
+        ? INTERFLOP_CHECKDENORMAL_API(user_call)
+        : Null,
     interflop_finalize : INTERFLOP_CHECKDENORMAL_API(finalize),
   };
   return interflop_backend_checkdenormal;
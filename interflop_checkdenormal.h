@@ -42,13 +42,117 @@ extern "C" {
 #define IFCD_DOOP
 
 #include "interflop/interflop.h"
+#include <stdint.h>
+
+/* Maximum number of --alert rules */
+#define CHECKDENORMAL_MAX_ALERTS 8
+
+typedef enum {
+  CHECKDENORMAL_ALERT_LOG,
+  CHECKDENORMAL_ALERT_REPORT,
+  CHECKDENORMAL_ALERT_TRAP,
+  CHECKDENORMAL_ALERT_HANDLER
+} checkdenormal_alert_action_t;
+
+/* Fire action when the fraction of operations producing a denormal */
+/* result exceeds threshold over a window of a thread */
+typedef struct checkdenorm_alert {
+  /* operation and type indices as in the stream records, -1 for any */
+  int op;
+  int type;
+  double threshold;
+  unsigned int window_ms;
+  checkdenormal_alert_action_t action;
+} checkdenormal_alert_t;
 
 typedef struct checkdenorm_conf {
   IBool flushtozero;
+  /* time one native operation out of latency_sampling (0 disables) */
+  unsigned int latency_sampling;
+  /* record exponents of one operation out of rescale_sampling (0 disables) */
+  unsigned int rescale_sampling;
+  /* re-evaluate denormal double operations in long double */
+  IBool extended_shadow;
+  /* check function arguments and return values for denormals */
+  IBool function_boundaries;
+  /* attribute denormal results to their call site and calling context */
+  IBool calling_context;
+  /* prefix of the site x time heatmap files, NULL disables */
+  const char *heatmap;
+  /* initial heatmap time window in milliseconds, 0 for the default */
+  unsigned int heatmap_window;
+  /* Prometheus textfile written periodically, NULL disables */
+  const char *metrics;
+  /* metrics update period in seconds, 0 for the default */
+  unsigned int metrics_interval;
+  /* UNIX socket path of the event collector, NULL disables */
+  const char *stream;
+  /* file receiving sampled operands of underflowing operations, NULL */
+  /* disables */
+  const char *record;
+  /* file listing the module+offset sites whose denormal results are */
+  /* flushed to zero, NULL disables */
+  const char *flush_sites;
+  /* number of frames between the backend entry point and the call site, */
+  /* 0 for the default */
+  unsigned int site_depth;
+  /* file receiving the finalize report, NULL for the backend stream */
+  const char *report_file;
+  /* writers captured per buffer registered for watching (0 disables) */
+  unsigned int watch;
+  /* scan period of the watched buffers in milliseconds, 0 for the default */
+  unsigned int watch_interval;
+  /* denormal-rate alert rules */
+  checkdenormal_alert_t alerts[CHECKDENORMAL_MAX_ALERTS];
+  unsigned int nb_alerts;
 } checkdenormal_conf_t;
 
 typedef checkdenormal_conf_t checkdenormal_context_t;
 
+/* Wire format of --stream: batches of a header followed by count records, */
+/* in host byte order */
+#define CHECKDENORMAL_STREAM_MAGIC 0x49464344
+
+typedef struct checkdenorm_stream_header {
+  uint32_t magic;
+  uint32_t pid;
+  uint32_t count;
+  uint32_t reserved;
+  /* events dropped by this process so far */
+  uint64_t dropped;
+} checkdenormal_stream_header_t;
+
+typedef struct checkdenorm_stream_record {
+  /* wall clock time of the event, from interflop_gettimeofday */
+  uint64_t time_ns;
+  /* offset of the call site in its module */
+  uint64_t offset;
+  /* denormal result */
+  double value;
+  uint32_t tid;
+  /* FNV-1a hash of the module basename */
+  uint32_t module;
+  /* operation and type indices: add, sub, mul, div, fma, cast and */
+  /* float, double */
+  uint8_t op;
+  uint8_t type;
+  uint8_t reserved[2];
+  /* low bits of the calling-context hash, 0 without --calling-context */
+  uint32_t context;
+} checkdenormal_stream_record_t;
+
+/* Buffers watched by --watch, registered with                          */
+/*   interflop_user_call(ctx, INTERFLOP_CUSTOM_ID, CHECKDENORMAL_CALL_WATCH, */
+/*                       const char *name, void *buffer, size_t count,     */
+/*                       int type)                                         */
+/* for count FFLOAT or FDOUBLE values, and unregistered with               */
+/*   interflop_user_call(ctx, INTERFLOP_CUSTOM_ID,                         */
+/*                       CHECKDENORMAL_CALL_UNWATCH, void *buffer)         */
+typedef enum {
+  CHECKDENORMAL_CALL_WATCH = 1,
+  CHECKDENORMAL_CALL_UNWATCH
+} checkdenormal_call_t;
+
 void INTERFLOP_CHECKDENORMAL_API(add_double)(double a, double b, double *res,
                                              void *context);
 void INTERFLOP_CHECKDENORMAL_API(add_float)(float a, float b, float *res,
@@ -73,6 +177,12 @@ void INTERFLOP_CHECKDENORMAL_API(fma_double)(double a, double b, double c,
                                              double *res, void *context);
 void INTERFLOP_CHECKDENORMAL_API(fma_float)(float a, float b, float c,
                                             float *res, void *context);
+void INTERFLOP_CHECKDENORMAL_API(enter_function)(
+    interflop_function_stack_t *stack, void *context, int nb_args, va_list ap);
+void INTERFLOP_CHECKDENORMAL_API(exit_function)(
+    interflop_function_stack_t *stack, void *context, int nb_args, va_list ap);
+void INTERFLOP_CHECKDENORMAL_API(user_call)(void *context, interflop_call_id id,
+                                            va_list ap);
 void INTERFLOP_CHECKDENORMAL_API(finalize)(void *context);
 
 const char *INTERFLOP_CHECKDENORMAL_API(get_backend_name)(void);
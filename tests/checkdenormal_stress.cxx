@@ -0,0 +1,503 @@
+/*--------------------------------------------------------------------*/
+/*--- checkdenormal-stress: many short threads with random denormal ---*/
+/*--- rates against every concurrent path of the backend            ---*/
+/*---                                    checkdenormal_stress.cxx ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 2.1 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU Lesser General Public License is contained in the file COPYING.
+*/
+
+/* Threads are started in waves so that exited thread states are reused  */
+/* while the metrics file, the alert report snapshots and the stream      */
+/* writer read the per-thread counters, site, boundary and context tables */
+/* and event rings. The test plays the frontend, including the function   */
+/* hooks, and the stream collector, then checks that every output         */
+/* accounts for exactly the operations and denormals performed.           */
+
+#include <argp.h>
+#include <atomic>
+#include <cerrno>
+#include <cfloat>
+#include <cstdarg>
+#include <ftw.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "interflop/interflop.h"
+#include "interflop/interflop_stdlib.h"
+#include "interflop_checkdenormal.h"
+
+#ifndef IFCD_USE_LIBC
+#define IFCD_USE_LIBC 1
+#endif
+
+/* Waves of threads started together */
+#define STRESS_WAVES 8
+#define STRESS_THREADS 16
+/* Operations per thread, at least STRESS_OPERATIONS */
+#define STRESS_OPERATIONS 20000
+/* Functions entering the operation functions, giving calling contexts */
+#define STRESS_CALLERS 4
+
+/* Sampling periods of the latency and exponent profiles */
+#if defined(__x86_64__)
+#define STRESS_LATENCY_SAMPLING 64
+#else
+#define STRESS_LATENCY_SAMPLING 0
+#endif
+#define STRESS_RESCALE_SAMPLING 64
+#define STRESS_SHADOW (LDBL_MAX_EXP > DBL_MAX_EXP)
+
+static std::atomic<uint64_t> expected_operations(0);
+static std::atomic<uint64_t> expected_denormals(0);
+/* denormal results of double operations, re-evaluated by the shadow */
+static std::atomic<uint64_t> expected_double_denormals(0);
+static std::atomic<uint64_t> handled_denormals(0);
+static int failures = 0;
+
+static void check(bool ok, const char *what, uint64_t got, uint64_t expected) {
+  fprintf(stderr, "%s %s: %lu, expected %lu\n", ok ? "ok  " : "FAIL", what,
+          (unsigned long)got, (unsigned long)expected);
+  failures += !ok;
+}
+
+// * Frontend
+
+static void stress_panic(const char *msg) {
+  fprintf(stderr, "%s", msg);
+  exit(1);
+}
+
+static void stress_denormal_handler(void) {
+  handled_denormals.fetch_add(1, std::memory_order_relaxed);
+}
+
+static File *stress_fopen(const char *path, const char *mode, int *error) {
+  FILE *file = fopen(path, mode);
+  if (file == NULL) {
+    *error = errno;
+  }
+  return (File *)file;
+}
+
+static long stress_strtol(const char *nptr, char **endptr, int *error) {
+  errno = 0;
+  long value = strtol(nptr, endptr, 10);
+  *error = errno;
+  return value;
+}
+
+static double stress_strtod(const char *nptr, char **endptr, int *error) {
+  errno = 0;
+  double value = strtod(nptr, endptr);
+  *error = errno;
+  return value;
+}
+
+static int stress_gettid(void) { return (int)syscall(SYS_gettid); }
+
+static void stress_set_handlers(void) {
+  interflop_set_handler("denormalHandler", (void *)stress_denormal_handler);
+  interflop_set_handler("malloc", (void *)malloc);
+  interflop_set_handler("calloc", (void *)calloc);
+  interflop_set_handler("free", (void *)free);
+  interflop_set_handler("fopen", (void *)stress_fopen);
+  interflop_set_handler("fclose", (void *)fclose);
+  interflop_set_handler("fprintf", (void *)fprintf);
+  interflop_set_handler("sprintf", (void *)sprintf);
+  interflop_set_handler("strerror", (void *)strerror);
+  interflop_set_handler("strcasecmp", (void *)strcasecmp);
+  interflop_set_handler("strcmp", (void *)strcmp);
+  interflop_set_handler("strtol", (void *)stress_strtol);
+  interflop_set_handler("strtod", (void *)stress_strtod);
+  interflop_set_handler("getenv", (void *)getenv);
+  interflop_set_handler("gettid", (void *)stress_gettid);
+  interflop_set_handler("gettimeofday", (void *)gettimeofday);
+  interflop_set_handler("argp_parse", (void *)argp_parse);
+}
+
+/* Instrumented functions passed to the function hooks: the callers, */
+/* then one function per operation */
+static interflop_function_info_t stress_functions[STRESS_CALLERS + 4];
+static const char *stress_function_names[STRESS_CALLERS + 4] = {
+    "caller0", "caller1",    "caller2",    "caller3",
+    "mul_double", "mul_float", "div_double", "fma_double"};
+
+/* Arguments are passed as (type, size, pointer) */
+static void stress_enter(interflop_function_stack_t *stack, void *ctx,
+                         int nb_args, ...) {
+  va_list ap;
+  va_start(ap, nb_args);
+  interflop_checkdenormal_enter_function(stack, ctx, nb_args, ap);
+  va_end(ap);
+}
+
+static void stress_exit(interflop_function_stack_t *stack, void *ctx,
+                        int nb_args, ...) {
+  va_list ap;
+  va_start(ap, nb_args);
+  interflop_checkdenormal_exit_function(stack, ctx, nb_args, ap);
+  va_end(ap);
+}
+
+/* Operations with a denormal result with probability percent / 100, */
+/* from several call sites, each in a function entered from one caller */
+static void stress_thread(void *ctx, unsigned int seed) {
+  unsigned int percent = rand_r(&seed) % 101;
+  unsigned int operations = STRESS_OPERATIONS + rand_r(&seed) % 4096;
+  uint64_t denormals = 0, double_denormals = 0;
+  interflop_function_info_t *frames[2];
+  interflop_function_stack_t stack = {frames, -1};
+  frames[++stack.top] = &stress_functions[seed % STRESS_CALLERS];
+  stress_enter(&stack, ctx, 0);
+  for (unsigned int i = 0; i < operations; i++) {
+    bool denormal = (unsigned int)(rand_r(&seed) % 100) < percent;
+    unsigned int kind = rand_r(&seed) % 4;
+    denormals += denormal;
+    double_denormals += denormal && kind != 1;
+    frames[++stack.top] = &stress_functions[STRESS_CALLERS + kind];
+    double a = denormal ? DBL_MIN : 1., d;
+    float af = denormal ? FLT_MIN : 1.f, f;
+    if (kind == 1) {
+      stress_enter(&stack, ctx, 1, (int)FFLOAT, 1u, (void *)&af);
+    } else {
+      stress_enter(&stack, ctx, 1, (int)FDOUBLE, 1u, (void *)&a);
+    }
+    switch (kind) {
+    case 0:
+      interflop_checkdenormal_mul_double(a, 0.5, &d, ctx);
+      break;
+    case 1:
+      interflop_checkdenormal_mul_float(af, 0.5f, &f, ctx);
+      break;
+    case 2:
+      interflop_checkdenormal_div_double(a, 4., &d, ctx);
+      break;
+    default:
+      interflop_checkdenormal_fma_double(a, 0.25, 0., &d, ctx);
+      break;
+    }
+    if (kind == 1) {
+      stress_exit(&stack, ctx, 1, (int)FFLOAT, 1u, (void *)&f);
+    } else {
+      stress_exit(&stack, ctx, 1, (int)FDOUBLE, 1u, (void *)&d);
+    }
+    stack.top--;
+  }
+  stress_exit(&stack, ctx, 0);
+  expected_operations.fetch_add(operations, std::memory_order_relaxed);
+  expected_denormals.fetch_add(denormals, std::memory_order_relaxed);
+  expected_double_denormals.fetch_add(double_denormals,
+                                      std::memory_order_relaxed);
+}
+
+// * Collector
+
+#if IFCD_USE_LIBC
+typedef struct collected {
+  uint64_t records;
+  uint64_t dropped;
+  bool closed;
+} collected_t;
+
+/* Read batches until the backend closes the connection */
+static void stress_collect(int listener, collected_t *out) {
+  struct pollfd pfd = {listener, POLLIN, 0};
+  if (poll(&pfd, 1, 60000) != 1) {
+    fprintf(stderr, "the stream writer did not connect\n");
+    return;
+  }
+  int fd = accept(listener, NULL, NULL);
+  if (fd < 0) {
+    return;
+  }
+  std::vector<char> data;
+  char buf[1 << 16];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    data.insert(data.end(), buf, buf + n);
+  }
+  close(fd);
+  size_t offset = 0;
+  while (offset + sizeof(checkdenormal_stream_header_t) <= data.size()) {
+    checkdenormal_stream_header_t header;
+    memcpy(&header, &data[offset], sizeof(header));
+    if (header.magic != CHECKDENORMAL_STREAM_MAGIC) {
+      fprintf(stderr, "bad stream magic at offset %zu\n", offset);
+      return;
+    }
+    offset += sizeof(header) +
+              header.count * sizeof(checkdenormal_stream_record_t);
+    if (offset > data.size()) {
+      fprintf(stderr, "truncated stream batch\n");
+      return;
+    }
+    out->records += header.count;
+    out->dropped = header.dropped;
+  }
+  out->closed = offset == data.size();
+}
+#endif
+
+// * Outputs
+
+/* Sum of the values of the metric lines starting with name */
+static uint64_t stress_metric(const std::string &path, const char *name) {
+  FILE *file = fopen(path.c_str(), "r");
+  if (file == NULL) {
+    fprintf(stderr, "cannot open %s\n", path.c_str());
+    return 0;
+  }
+  uint64_t sum = 0;
+  char line[1024];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (strncmp(line, name, strlen(name)) == 0) {
+      sum += strtoull(strrchr(line, ' ') + 1, NULL, 10);
+    }
+  }
+  fclose(file);
+  return sum;
+}
+
+/* Sum of the row totals of the heatmap */
+static uint64_t stress_heatmap_total(const std::string &path) {
+  FILE *file = fopen(path.c_str(), "r");
+  if (file == NULL) {
+    fprintf(stderr, "cannot open %s\n", path.c_str());
+    return 0;
+  }
+  uint64_t sum = 0;
+  char line[1 << 14];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    const char *total = strstr(line, " total=");
+    if (total != NULL) {
+      sum += strtoull(total + 7, NULL, 10);
+    }
+  }
+  fclose(file);
+  return sum;
+}
+
+/* Sum of the values of key=VALUE in the report lines starting with prefix */
+static uint64_t stress_report_sum(const std::string &path, const char *prefix,
+                                  const char *key) {
+  FILE *file = fopen(path.c_str(), "r");
+  if (file == NULL) {
+    fprintf(stderr, "cannot open %s\n", path.c_str());
+    return 0;
+  }
+  std::string pattern = std::string(" ") + key + "=";
+  uint64_t sum = 0;
+  char line[1 << 14];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    const char *value = strstr(line, pattern.c_str());
+    if (strncmp(line, prefix, strlen(prefix)) == 0 && value != NULL) {
+      sum += strtoull(value + pattern.size(), NULL, 10);
+    }
+  }
+  fclose(file);
+  return sum;
+}
+
+/* Sum of the denormal counts of the "boundary" report lines, printed as */
+/* argN:denormal/checked and retN:denormal/checked */
+static uint64_t stress_boundary_denormals(const std::string &path) {
+  FILE *file = fopen(path.c_str(), "r");
+  if (file == NULL) {
+    fprintf(stderr, "cannot open %s\n", path.c_str());
+    return 0;
+  }
+  uint64_t sum = 0;
+  char line[1 << 14];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (strncmp(line, "boundary ", 9) != 0) {
+      continue;
+    }
+    for (char *p = strchr(line, ':'); p != NULL; p = strchr(p + 1, ':')) {
+      sum += strtoull(p + 1, NULL, 10);
+    }
+  }
+  fclose(file);
+  return sum;
+}
+
+/* Number of report lines starting with prefix and containing text */
+static uint64_t stress_report_lines(const std::string &path,
+                                    const char *prefix, const char *text) {
+  FILE *file = fopen(path.c_str(), "r");
+  if (file == NULL) {
+    fprintf(stderr, "cannot open %s\n", path.c_str());
+    return 0;
+  }
+  uint64_t count = 0;
+  char line[1 << 14];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    count += strncmp(line, prefix, strlen(prefix)) == 0 &&
+             strstr(line, text) != NULL;
+  }
+  fclose(file);
+  return count;
+}
+
+static int stress_remove(const char *path, const struct stat *, int,
+                         struct FTW *) {
+  return remove(path);
+}
+
+int main(void) {
+  char dir_template[] = "/tmp/checkdenormal-stress.XXXXXX";
+  const char *dir = mkdtemp(dir_template);
+  if (dir == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+  std::string heatmap = std::string(dir) + "/heatmap";
+  std::string metrics = std::string(dir) + "/metrics.prom";
+  std::string report = std::string(dir) + "/report";
+  std::string record = std::string(dir) + "/record";
+  std::string socket_path = std::string(dir) + "/collector.sock";
+
+  stress_set_handlers();
+  void *ctx;
+  interflop_checkdenormal_pre_init(stress_panic, (File *)stderr, &ctx);
+
+  /* Zero-initialized as by a frontend setting only what it uses */
+  checkdenormal_conf_t conf;
+  memset(&conf, 0, sizeof(conf));
+  conf.latency_sampling = STRESS_LATENCY_SAMPLING;
+  conf.rescale_sampling = STRESS_RESCALE_SAMPLING;
+  conf.extended_shadow = STRESS_SHADOW;
+  conf.function_boundaries = 1;
+  conf.site_depth = 1;
+  conf.calling_context = IFCD_USE_LIBC;
+  conf.heatmap = heatmap.c_str();
+  conf.metrics = metrics.c_str();
+  conf.metrics_interval = 1;
+  conf.record = record.c_str();
+  conf.report_file = report.c_str();
+  conf.alerts[0] = {-1, -1, 0.5, 1, CHECKDENORMAL_ALERT_REPORT};
+  conf.nb_alerts = 1;
+
+#if IFCD_USE_LIBC
+  collected_t collected = {0, 0, false};
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path.c_str());
+  if (listener < 0 ||
+      bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(listener, 1) != 0) {
+    perror("collector socket");
+    return 1;
+  }
+  std::thread collector(stress_collect, listener, &collected);
+  std::string stream = "unix:" + socket_path;
+  conf.stream = stream.c_str();
+#endif
+
+  for (unsigned int i = 0; i < STRESS_CALLERS + 4; i++) {
+    stress_functions[i].id = (char *)stress_function_names[i];
+  }
+  interflop_checkdenormal_configure(&conf, ctx);
+  interflop_checkdenormal_init(ctx);
+
+  for (unsigned int wave = 0; wave < STRESS_WAVES; wave++) {
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < STRESS_THREADS; i++) {
+      threads.emplace_back(stress_thread, ctx, wave * STRESS_THREADS + i + 1);
+    }
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+  }
+  interflop_checkdenormal_finalize(ctx);
+
+  uint64_t operations = expected_operations.load();
+  uint64_t denormals = expected_denormals.load();
+  check(handled_denormals.load() == denormals, "denormal handler calls",
+        handled_denormals.load(), denormals);
+  uint64_t value = stress_metric(metrics, "checkdenormal_operations_total{");
+  check(value == operations, "metrics operations", value, operations);
+  value = stress_metric(metrics, "checkdenormal_denormals_total{");
+  check(value == denormals, "metrics denormals", value, denormals);
+  value = stress_heatmap_total(heatmap + ".heatmap");
+  check(value == denormals, "heatmap events", value, denormals);
+  value = stress_report_sum(report, "boundary ", "calls");
+  check(value == operations, "boundary calls", value, operations);
+  value = stress_boundary_denormals(report);
+  check(value == denormals, "boundary denormal values", value, denormals);
+  uint64_t double_denormals = expected_double_denormals.load();
+  if (STRESS_SHADOW) {
+    value = stress_report_sum(report, "shadow ", "range") +
+            stress_report_sum(report, "shadow ", "tiny") +
+            stress_report_sum(report, "shadow ", "zero");
+    check(value == double_denormals, "shadow re-evaluations", value,
+          double_denormals);
+  }
+#if IFCD_USE_LIBC
+  /* the site table holds the same samples as the per-operation counters */
+  if (STRESS_SHADOW) {
+    value = stress_report_sum(report, "shadow_site ", "range") +
+            stress_report_sum(report, "shadow_site ", "tiny") +
+            stress_report_sum(report, "shadow_site ", "zero");
+    check(value == double_denormals, "site shadow re-evaluations", value,
+          double_denormals);
+  }
+  if (STRESS_LATENCY_SAMPLING != 0) {
+    uint64_t samples = stress_report_sum(report, "latency ", "samples");
+    value = stress_report_sum(report, "site_latency ", "samples");
+    check(samples != 0 && value == samples, "site latency samples", value,
+          samples);
+  }
+  uint64_t values = stress_report_sum(report, "rescale_function ", "values");
+  value = stress_report_sum(report, "rescale ", "values");
+  check(values != 0 && value == values, "site rescale values", value, values);
+  value = stress_report_sum(report, "context ", "denormals");
+  check(value == denormals, "calling context denormals", value, denormals);
+  value = stress_report_lines(report, "context ", "hash=0x0000000000000000");
+  check(value == 0, "contexts without caller", value, 0);
+  /* exited thread states are released */
+  value = stress_metric(metrics, "checkdenormal_threads ");
+  check(value == 0, "metrics live threads", value, 0);
+  collector.join();
+  close(listener);
+  check(collected.closed, "stream batches complete", collected.closed, 1);
+  check(collected.records + collected.dropped == denormals,
+        "stream records + dropped", collected.records + collected.dropped,
+        denormals);
+#endif
+
+  if (failures == 0) {
+    nftw(dir, stress_remove, 16, FTW_DEPTH | FTW_PHYS);
+  } else {
+    fprintf(stderr, "outputs kept in %s\n", dir);
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,431 @@
+/*--------------------------------------------------------------------*/
+/*--- checkdenormal-ddmin: search a minimal set of sites to flush  ---*/
+/*--- with --flush-sites by delta debugging                        ---*/
+/*---                                      checkdenormal_ddmin.cxx ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 2.1 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU Lesser General Public License is contained in the file COPYING.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <ftw.h>
+#include <functional>
+#include <map>
+#include <set>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+extern char **environ;
+
+/* Environment of the command and of the check */
+static const char env_sites[] = "CHECKDENORMAL_FLUSH_SITES";
+static const char env_run_dir[] = "CHECKDENORMAL_RUN_DIR";
+
+/* Site flushed by the run without flush. Offset 0 is never the address of */
+/* an instruction, so it matches nothing, but every denormal result still */
+/* pays the site lookup paid by the other sets and the timings compare. */
+static const char baseline_site[] = "checkdenormal-ddmin-baseline+0x0";
+
+typedef struct options {
+  const char *command;
+  /* accuracy check, NULL accepts every run */
+  const char *check;
+  long jobs;
+  /* runs of the command per tested set, the fastest is kept */
+  long runs;
+  /* fraction of the time gained by flushing every site to recover */
+  double gain;
+  bool keep;
+} options_t;
+
+/* Outcome of the runs of the command with a set of flushed sites */
+typedef struct test {
+  /* indices of the flushed sites, sorted */
+  std::vector<size_t> sites;
+  double seconds;
+  bool succeeded;
+  bool accurate;
+} test_t;
+
+/* Sites as listed in the input, unique by module+0xoffset */
+static std::vector<std::string> site_names;
+
+// * Input
+
+/* module+0xoffset part of a site, the part read by --flush-sites */
+static std::string site_key(const std::string &name) {
+  return name.substr(0, name.find('('));
+}
+
+/* Read a list of sites, one per line, or the records written by */
+/* --record, whose site is split from the right of each line. */
+static void read_sites(const char *path) {
+  FILE *in = fopen(path, "r");
+  if (in == NULL) {
+    fprintf(stderr, "checkdenormal-ddmin: cannot open %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  std::set<std::string> seen;
+  char line[8192];
+  while (fgets(line, sizeof(line), in) != NULL) {
+    line[strcspn(line, "\r\n")] = '\0';
+    char *start = line + strspn(line, " \t");
+    if (start[0] == '#' || start[0] == '\0') {
+      continue;
+    }
+    int commas = 0;
+    for (char *p = start; *p != '\0'; p++) {
+      commas += (*p == ',');
+    }
+    for (int f = 0; commas >= 6 && f < 6; f++) {
+      *strrchr(start, ',') = '\0';
+    }
+    std::string name(start);
+    if (name.find("+0x") == std::string::npos) {
+      fprintf(stderr, "checkdenormal-ddmin: %s: invalid site %s\n", path,
+              start);
+      exit(EXIT_FAILURE);
+    }
+    if (seen.insert(site_key(name)).second) {
+      site_names.push_back(name);
+    }
+  }
+  fclose(in);
+}
+
+// * Runs
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Run the shell command in the run directory with its output redirected */
+/* there, return its exit status or -1 */
+static int run_shell(const char *command, const std::string &dir,
+                     const char *name) {
+  std::string sites = dir + "/sites";
+  std::string stdout_path = dir + "/" + name + ".out";
+  std::string stderr_path = dir + "/" + name + ".err";
+  std::string sites_var = std::string(env_sites) + "=" + sites;
+  std::string dir_var = std::string(env_run_dir) + "=" + dir;
+  std::vector<char *> envp;
+  for (char **env = environ; *env != NULL; env++) {
+    if (strncmp(*env, env_sites, strlen(env_sites)) != 0 &&
+        strncmp(*env, env_run_dir, strlen(env_run_dir)) != 0) {
+      envp.push_back(*env);
+    }
+  }
+  envp.push_back(&sites_var[0]);
+  envp.push_back(&dir_var[0]);
+  envp.push_back(NULL);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null",
+                                   O_RDONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+                                   stdout_path.c_str(),
+                                   O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  posix_spawn_file_actions_addopen(&actions, STDERR_FILENO,
+                                   stderr_path.c_str(),
+                                   O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  char *argv[] = {(char *)"sh", (char *)"-c", (char *)command, NULL};
+  pid_t pid;
+  int error = posix_spawn(&pid, "/bin/sh", &actions, NULL, argv, &envp[0]);
+  posix_spawn_file_actions_destroy(&actions);
+  if (error != 0) {
+    return -1;
+  }
+  int status;
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+    return -1;
+  }
+  return WEXITSTATUS(status);
+}
+
+static int remove_entry(const char *path, const struct stat *, int,
+                        struct FTW *) {
+  return remove(path);
+}
+
+/* Run the command with the sites of test flushed, then the check on the */
+/* output of the last run */
+static void run_test(const options_t *options, test_t *test) {
+  const char *tmpdir = getenv("TMPDIR");
+  std::string dir = std::string(tmpdir != NULL ? tmpdir : "/tmp") +
+                    "/checkdenormal-ddmin.XXXXXX";
+  if (mkdtemp(&dir[0]) == NULL) {
+    fprintf(stderr, "checkdenormal-ddmin: cannot create %s\n", dir.c_str());
+    exit(EXIT_FAILURE);
+  }
+  FILE *out = fopen((dir + "/sites").c_str(), "w");
+  if (out == NULL) {
+    fprintf(stderr, "checkdenormal-ddmin: cannot write in %s\n", dir.c_str());
+    exit(EXIT_FAILURE);
+  }
+  for (size_t site : test->sites) {
+    fprintf(out, "%s\n", site_names[site].c_str());
+  }
+  if (test->sites.empty()) {
+    fprintf(out, "%s\n", baseline_site);
+  }
+  fclose(out);
+
+  test->seconds = 0;
+  test->succeeded = true;
+  for (long run = 0; run < options->runs && test->succeeded; run++) {
+    double start = now_seconds();
+    test->succeeded = (run_shell(options->command, dir, "command") == 0);
+    double seconds = now_seconds() - start;
+    test->seconds = (run == 0) ? seconds : std::min(test->seconds, seconds);
+  }
+  test->accurate = test->succeeded &&
+                   (options->check == NULL ||
+                    run_shell(options->check, dir, "check") == 0);
+  if (options->keep) {
+    fprintf(stderr, "checkdenormal-ddmin: kept %s\n", dir.c_str());
+  } else {
+    nftw(dir.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+  }
+}
+
+/* Results of the sets already tested */
+static std::map<std::vector<size_t>, test_t> tested;
+
+/* Run the tests not already in the cache, jobs at a time */
+static void run_tests(const options_t *options,
+                      std::vector<std::vector<size_t>> &sets) {
+  std::vector<test_t> pending;
+  for (std::vector<size_t> &set : sets) {
+    std::sort(set.begin(), set.end());
+    bool queued = false;
+    for (const test_t &test : pending) {
+      queued = queued || (test.sites == set);
+    }
+    if (tested.find(set) == tested.end() && !queued) {
+      pending.emplace_back();
+      pending.back().sites = set;
+    }
+  }
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (long j = 0; j < std::min<long>(options->jobs, (long)pending.size());
+       j++) {
+    workers.emplace_back([&]() {
+      for (size_t k = next++; k < pending.size(); k = next++) {
+        run_test(options, &pending[k]);
+      }
+    });
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  for (const test_t &test : pending) {
+    fprintf(stderr, "ddmin test sites=%zu time=%.3fs %s\n", test.sites.size(),
+            test.seconds,
+            !test.succeeded ? "failed"
+            : test.accurate ? "accurate"
+                            : "inaccurate");
+    tested[test.sites] = test;
+  }
+}
+
+// * Search
+
+typedef std::function<bool(const test_t &)> predicate_t;
+
+/* ddmin: split the set in n chunks and reduce it to the first passing */
+/* chunk, or else to the first passing complement, refining the split */
+/* until every chunk is a single site. Chunks and complements of a  */
+/* round are tested together. */
+static std::vector<size_t> ddmin(const options_t *options,
+                                 std::vector<size_t> set,
+                                 const predicate_t &passes) {
+  size_t n = 2;
+  while (set.size() >= 2) {
+    n = std::min(n, set.size());
+    std::vector<std::vector<size_t>> chunks(n), complements(n);
+    for (size_t i = 0; i < set.size(); i++) {
+      size_t chunk = i * n / set.size();
+      chunks[chunk].push_back(set[i]);
+      for (size_t c = 0; c < n; c++) {
+        if (c != chunk) {
+          complements[c].push_back(set[i]);
+        }
+      }
+    }
+    std::vector<std::vector<size_t>> sets = chunks;
+    if (n > 2) {
+      sets.insert(sets.end(), complements.begin(), complements.end());
+    }
+    run_tests(options, sets);
+
+    bool reduced = false;
+    for (size_t c = 0; c < n && !reduced; c++) {
+      if (passes(tested[sets[c]])) {
+        set = sets[c];
+        n = 2;
+        reduced = true;
+      }
+    }
+    for (size_t c = 0; c < n && !reduced && n > 2; c++) {
+      if (passes(tested[sets[n + c]])) {
+        set = sets[n + c];
+        n = n - 1;
+        reduced = true;
+      }
+    }
+    if (!reduced) {
+      if (n == set.size()) {
+        break;
+      }
+      n = 2 * n;
+    }
+  }
+  return set;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: checkdenormal-ddmin [-j JOBS] [-r RUNS] [-g GAIN] "
+          "[-c CHECK] [-k] SITES COMMAND\n"
+          "Search a minimal set of the sites listed in SITES whose flushing\n"
+          "with --flush-sites=$%s recovers GAIN of the time\n"
+          "gained by flushing every site, while CHECK succeeds.\n"
+          "COMMAND and CHECK are run by sh in the current directory, with\n"
+          "their output in $%s.\n"
+          "  -j JOBS  commands run in parallel (default 1)\n"
+          "  -r RUNS  runs per tested set, the fastest is kept (default 1)\n"
+          "  -g GAIN  fraction of the time gain to recover (default 0.9)\n"
+          "  -c CHECK accuracy check, succeeds when accurate\n"
+          "  -k       keep the run directories\n",
+          env_sites, env_run_dir);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  options_t options = {NULL, NULL, 1, 1, 0.9, false};
+  int opt;
+  while ((opt = getopt(argc, argv, "+j:r:g:c:kh")) != -1) {
+    switch (opt) {
+    case 'j':
+      options.jobs = strtol(optarg, NULL, 10);
+      break;
+    case 'r':
+      options.runs = strtol(optarg, NULL, 10);
+      break;
+    case 'g':
+      options.gain = strtod(optarg, NULL);
+      break;
+    case 'c':
+      options.check = optarg;
+      break;
+    case 'k':
+      options.keep = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind != 2 || options.jobs <= 0 || options.runs <= 0 ||
+      !(options.gain >= 0 && options.gain <= 1)) {
+    usage();
+  }
+  read_sites(argv[optind]);
+  options.command = argv[optind + 1];
+  if (site_names.empty()) {
+    fprintf(stderr, "checkdenormal-ddmin: no site in %s\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+
+  std::vector<size_t> none, all;
+  for (size_t i = 0; i < site_names.size(); i++) {
+    all.push_back(i);
+  }
+  std::vector<std::vector<size_t>> sets = {none, all};
+  run_tests(&options, sets);
+  const test_t &baseline = tested[none];
+  if (!baseline.accurate) {
+    fprintf(stderr, "checkdenormal-ddmin: the run without flush is %s\n",
+            baseline.succeeded ? "inaccurate" : "failed");
+    return EXIT_FAILURE;
+  }
+
+  /* Exclude the minimal sets of sites breaking the check until flushing */
+  /* the remaining candidates is accurate */
+  std::vector<size_t> candidates = all;
+  while (!tested[candidates].accurate) {
+    std::vector<size_t> culprits =
+        ddmin(&options, candidates,
+              [](const test_t &test) { return !test.accurate; });
+    for (size_t site : culprits) {
+      fprintf(stderr, "ddmin excluded %s\n", site_names[site].c_str());
+      candidates.erase(
+          std::find(candidates.begin(), candidates.end(), site));
+    }
+    if (candidates.empty()) {
+      fprintf(stderr, "checkdenormal-ddmin: no site can be flushed\n");
+      return EXIT_FAILURE;
+    }
+    sets = {candidates};
+    run_tests(&options, sets);
+  }
+
+  const test_t &flushed = tested[candidates];
+  /* without a gain, the target would accept nearly every set */
+  if (flushed.seconds >= baseline.seconds) {
+    fprintf(stderr,
+            "checkdenormal-ddmin: flushing the candidates takes %.3fs, not "
+            "less than %.3fs without flush\n",
+            flushed.seconds, baseline.seconds);
+    return EXIT_FAILURE;
+  }
+  double target = baseline.seconds -
+                  options.gain * (baseline.seconds - flushed.seconds);
+  std::vector<size_t> set =
+      ddmin(&options, candidates, [target](const test_t &test) {
+        return test.accurate && test.seconds <= target;
+      });
+  const test_t &selected = tested[set];
+  double gained = baseline.seconds - flushed.seconds;
+  fprintf(stderr,
+          "ddmin tests=%zu sites=%zu/%zu time=%.3fs none=%.3fs "
+          "candidates=%.3fs recovered=%.1f%%\n",
+          tested.size(), set.size(), site_names.size(), selected.seconds,
+          baseline.seconds, flushed.seconds,
+          gained > 0 ? 100 * (baseline.seconds - selected.seconds) / gained
+                     : 100.);
+  for (size_t site : set) {
+    printf("%s\n", site_names[site].c_str());
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,507 @@
+/*--------------------------------------------------------------------*/
+/*--- checkdenormal-whatif: re-evaluate the operands recorded by   ---*/
+/*--- the checkdenormal backend under every flush policy           ---*/
+/*---                                     checkdenormal_whatif.cxx ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 2.1 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU Lesser General Public License is contained in the file COPYING.
+*/
+
+/* Must not be built with -ffast-math: the gradual underflow baseline is  */
+/* computed natively. */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/* Operations and types, named as in the record file */
+typedef enum {
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_FMA,
+  OP_CAST,
+  OP_END
+} op_t;
+
+typedef enum { TYPE_FLOAT, TYPE_DOUBLE, TYPE_END } type_t;
+
+static const char *op_name[OP_END] = {"add", "sub", "mul",
+                                      "div", "fma", "cast"};
+static const char *type_name[TYPE_END] = {"float", "double"};
+
+typedef enum {
+  /* IEEE-754 gradual underflow, the baseline */
+  POLICY_GRADUAL,
+  /* tiny results flushed to zero */
+  POLICY_FTZ,
+  /* denormal operands and tiny results flushed to zero */
+  POLICY_FTZ_DAZ,
+  /* tiny results replaced by the smallest normal of the same sign */
+  POLICY_MIN_NORMAL,
+  /* tiny results rounded to zero or to the smallest normal with a */
+  /* probability proportional to their distance, unbiased */
+  POLICY_STOCHASTIC,
+  POLICY_END
+} policy_t;
+
+static const char *policy_name[POLICY_END] = {
+    "gradual", "ftz", "ftz-daz", "min-normal", "stochastic"};
+
+/* Policy applied by a platform to each type */
+typedef struct profile {
+  const char *name;
+  policy_t policy[TYPE_END];
+} profile_t;
+
+static const profile_t profiles[] = {
+    /* MXCSR FTZ and DAZ set at startup by -ffast-math */
+    {"x86-fast-math", {POLICY_FTZ_DAZ, POLICY_FTZ_DAZ}},
+    /* AArch32 NEON flushes single precision only */
+    {"arm-neon", {POLICY_FTZ_DAZ, POLICY_GRADUAL}},
+    /* nvcc -ftz=true flushes single precision only */
+    {"cuda-ftz", {POLICY_FTZ_DAZ, POLICY_GRADUAL}},
+};
+
+#define NB_PROFILES (int)(sizeof(profiles) / sizeof(profiles[0]))
+/* Policies other than the baseline, then profiles */
+#define NB_COLUMNS (POLICY_END - 1 + NB_PROFILES)
+
+typedef struct outcome {
+  /* weight of the operations whose result differs from the baseline */
+  double changed;
+  /* weight of the operations whose nonzero result becomes zero */
+  double zeroed;
+  double max_change;
+} outcome_t;
+
+typedef struct site {
+  std::string name;
+  op_t op;
+  type_t type;
+  /* structure of arrays of the samples */
+  std::vector<double> a, b, c, weight;
+  double operations;
+  outcome_t outcomes[NB_COLUMNS];
+} site_t;
+
+// * Evaluation
+
+/* Counter-based uniform in [0, 1), so that sites evaluate independently */
+static inline double uniform(uint64_t seed, uint64_t i) {
+  uint64_t z = seed + (i + 1) * 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z ^= z >> 31;
+  return (double)(z >> 11) * 0x1p-53;
+}
+
+template <typename T> static inline T flush(T x) {
+  const T min = std::numeric_limits<T>::min();
+  return (std::fabs(x) < min) ? std::copysign(T(0), x) : x;
+}
+
+template <op_t OP, typename IN, typename OUT>
+static inline OUT native(IN x, IN y, IN z) {
+  switch (OP) {
+  case OP_ADD:
+    return x + y;
+  case OP_SUB:
+    return x - y;
+  case OP_MUL:
+    return x * y;
+  case OP_DIV:
+    return x / y;
+  case OP_FMA:
+    return std::fma(x, y, z);
+  default:
+    return (OUT)x;
+  }
+}
+
+/* Magnitude of the exact result relative to the smallest normal of OUT.  */
+/* Double results are computed with one operand scaled by 2^128 so that   */
+/* results below the subnormal range keep their magnitude, and nonzero    */
+/* results lost even then get the smallest positive ratio. */
+template <op_t OP, typename IN, typename OUT>
+static inline double tiny_ratio(IN x, IN y, IN z) {
+  const double scale = (sizeof(OUT) == sizeof(double)) ? 0x1p128 : 1.;
+  double dx = x, dy = y, dz = z;
+  double small = (std::fabs(dx) < std::fabs(dy)) ? dx : dy;
+  double big = (std::fabs(dx) < std::fabs(dy)) ? dy : dx;
+  double xs;
+  bool nonzero;
+  switch (OP) {
+  case OP_ADD:
+    xs = dx * scale + dy * scale;
+    nonzero = (xs != 0);
+    break;
+  case OP_SUB:
+    xs = dx * scale - dy * scale;
+    nonzero = (xs != 0);
+    break;
+  case OP_MUL:
+    xs = (small * scale) * big;
+    nonzero = (dx != 0) & (dy != 0);
+    break;
+  case OP_DIV:
+    xs = (dx * scale) / dy;
+    nonzero = (dx != 0) & !std::isinf(dy);
+    break;
+  case OP_FMA:
+    xs = std::fma(small * scale, big, dz * scale);
+    nonzero = (xs != 0) | ((dx != 0) & (dy != 0) & (dz == 0));
+    break;
+  default:
+    xs = dx;
+    nonzero = (dx != 0);
+    break;
+  }
+  double t =
+      std::fabs(xs) / ((double)std::numeric_limits<OUT>::min() * scale);
+  return (nonzero & (t == 0)) ? std::numeric_limits<double>::denorm_min() : t;
+}
+
+/* Evaluate the samples of a site under a policy. The policy is a      */
+/* template parameter and the loop body is branch-free, so that it     */
+/* vectorizes with -fno-trapping-math, except for the stochastic       */
+/* policy and fma, which need 64-bit vector multiplies and hardware    */
+/* fma, and stay scalar on baseline x86-64. */
+template <op_t OP, policy_t POLICY, typename IN, typename OUT>
+static void evaluate(const site_t *site, uint64_t seed,
+                     std::vector<double> &results) {
+  const OUT min = std::numeric_limits<OUT>::min();
+  size_t n = site->a.size();
+  results.resize(n);
+  const double *__restrict a = site->a.data();
+  const double *__restrict b = site->b.data();
+  const double *__restrict c = site->c.data();
+  double *__restrict r = results.data();
+  for (size_t i = 0; i < n; i++) {
+    IN x = (IN)a[i], y = (IN)b[i], z = (IN)c[i];
+    if (POLICY == POLICY_FTZ_DAZ) {
+      x = flush(x);
+      y = flush(y);
+      z = flush(z);
+    }
+    OUT g = native<OP, IN, OUT>(x, y, z);
+    double t = tiny_ratio<OP, IN, OUT>(x, y, z);
+    bool tiny = (t > 0) & (t < 1);
+    OUT zero = std::copysign(OUT(0), g);
+    OUT normal = std::copysign(min, g);
+    switch (POLICY) {
+    case POLICY_FTZ:
+    case POLICY_FTZ_DAZ:
+      r[i] = tiny ? zero : g;
+      break;
+    case POLICY_MIN_NORMAL:
+      r[i] = tiny ? normal : g;
+      break;
+    case POLICY_STOCHASTIC:
+      r[i] = tiny ? ((uniform(seed, i) < t) ? normal : zero) : g;
+      break;
+    default:
+      r[i] = g;
+      break;
+    }
+  }
+}
+
+template <op_t OP, typename IN, typename OUT>
+static void evaluate_policy(const site_t *site, policy_t policy, uint64_t seed,
+                            std::vector<double> &results) {
+  switch (policy) {
+  case POLICY_FTZ:
+    evaluate<OP, POLICY_FTZ, IN, OUT>(site, seed, results);
+    break;
+  case POLICY_FTZ_DAZ:
+    evaluate<OP, POLICY_FTZ_DAZ, IN, OUT>(site, seed, results);
+    break;
+  case POLICY_MIN_NORMAL:
+    evaluate<OP, POLICY_MIN_NORMAL, IN, OUT>(site, seed, results);
+    break;
+  case POLICY_STOCHASTIC:
+    evaluate<OP, POLICY_STOCHASTIC, IN, OUT>(site, seed, results);
+    break;
+  default:
+    evaluate<OP, POLICY_GRADUAL, IN, OUT>(site, seed, results);
+    break;
+  }
+}
+
+template <typename IN, typename OUT>
+static void evaluate_type(const site_t *site, policy_t policy, uint64_t seed,
+                          std::vector<double> &results) {
+  switch (site->op) {
+  case OP_ADD:
+    evaluate_policy<OP_ADD, IN, OUT>(site, policy, seed, results);
+    break;
+  case OP_SUB:
+    evaluate_policy<OP_SUB, IN, OUT>(site, policy, seed, results);
+    break;
+  case OP_MUL:
+    evaluate_policy<OP_MUL, IN, OUT>(site, policy, seed, results);
+    break;
+  case OP_DIV:
+    evaluate_policy<OP_DIV, IN, OUT>(site, policy, seed, results);
+    break;
+  case OP_FMA:
+    evaluate_policy<OP_FMA, IN, OUT>(site, policy, seed, results);
+    break;
+  default:
+    break;
+  }
+}
+
+static void evaluate_site(const site_t *site, policy_t policy, uint64_t seed,
+                          std::vector<double> &results) {
+  if (site->op == OP_CAST) {
+    evaluate_policy<OP_CAST, double, float>(site, policy, seed, results);
+  } else if (site->type == TYPE_FLOAT) {
+    evaluate_type<float, float>(site, policy, seed, results);
+  } else {
+    evaluate_type<double, double>(site, policy, seed, results);
+  }
+}
+
+static void compare(const site_t *site, const std::vector<double> &baseline,
+                    const std::vector<double> &results, outcome_t *outcome) {
+  *outcome = outcome_t();
+  for (size_t i = 0; i < results.size(); i++) {
+    double r = results[i], g = baseline[i];
+    if (r == g || (std::isnan(r) && std::isnan(g))) {
+      continue;
+    }
+    outcome->changed += site->weight[i];
+    if (r == 0) {
+      outcome->zeroed += site->weight[i];
+    }
+    double change = std::fabs(r - g);
+    if (change > outcome->max_change) {
+      outcome->max_change = change;
+    }
+  }
+}
+
+/* Result type of the operations of the site */
+static type_t result_type(const site_t *site) {
+  return (site->op == OP_CAST) ? TYPE_FLOAT : site->type;
+}
+
+static void process_site(site_t *site, uint64_t seed) {
+  /* Decorrelate the stochastic draws of the sites */
+  uint64_t site_seed = seed;
+  for (char ch : site->name) {
+    site_seed = (site_seed ^ (unsigned char)ch) * 0x100000001B3ULL;
+  }
+  std::vector<double> baseline, results[POLICY_END];
+  evaluate_site(site, POLICY_GRADUAL, site_seed, baseline);
+  for (int policy = POLICY_GRADUAL + 1; policy < POLICY_END; policy++) {
+    evaluate_site(site, (policy_t)policy, site_seed, results[policy]);
+    compare(site, baseline, results[policy], &site->outcomes[policy - 1]);
+  }
+  for (int p = 0; p < NB_PROFILES; p++) {
+    policy_t policy = profiles[p].policy[result_type(site)];
+    outcome_t *outcome = &site->outcomes[POLICY_END - 1 + p];
+    if (policy == POLICY_GRADUAL) {
+      *outcome = outcome_t();
+    } else {
+      *outcome = site->outcomes[policy - 1];
+    }
+  }
+}
+
+// * Input
+
+static int lookup(const char *name, const char **names, int nb_names) {
+  for (int i = 0; i < nb_names; i++) {
+    if (strcmp(name, names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* Parse the site,op,type,weight,a,b,c lines written by --record. The  */
+/* site is split from the right since symbol names may contain commas. */
+static void read_records(const char *path, std::vector<site_t> &sites,
+                         std::map<std::string, size_t> &index) {
+  FILE *in = fopen(path, "r");
+  if (in == NULL) {
+    fprintf(stderr, "checkdenormal-whatif: cannot open %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  char line[8192];
+  unsigned long lineno = 0;
+  while (fgets(line, sizeof(line), in) != NULL) {
+    lineno++;
+    line[strcspn(line, "\n")] = '\0';
+    if (line[0] == '#' || line[0] == '\0') {
+      continue;
+    }
+    char *fields[7];
+    fields[0] = line;
+    bool valid = true;
+    for (int f = 6; f > 0 && valid; f--) {
+      char *comma = strrchr(line, ',');
+      valid = (comma != NULL);
+      if (valid) {
+        *comma = '\0';
+        fields[f] = comma + 1;
+      }
+    }
+    int op = valid ? lookup(fields[1], op_name, OP_END) : -1;
+    int type = valid ? lookup(fields[2], type_name, TYPE_END) : -1;
+    if (op < 0 || type < 0) {
+      fprintf(stderr, "checkdenormal-whatif: %s:%lu: invalid record\n", path,
+              lineno);
+      exit(EXIT_FAILURE);
+    }
+    std::string key = std::string(fields[0]) + "," + fields[1] + "," +
+                      fields[2];
+    auto it = index.find(key);
+    if (it == index.end()) {
+      it = index.emplace(key, sites.size()).first;
+      sites.emplace_back();
+      sites.back().name = fields[0];
+      sites.back().op = (op_t)op;
+      sites.back().type = (type_t)type;
+      sites.back().operations = 0;
+    }
+    site_t *site = &sites[it->second];
+    double weight = strtod(fields[3], NULL);
+    site->weight.push_back(weight);
+    site->a.push_back(strtod(fields[4], NULL));
+    site->b.push_back(strtod(fields[5], NULL));
+    site->c.push_back(strtod(fields[6], NULL));
+    site->operations += weight;
+  }
+  fclose(in);
+}
+
+// * Output
+
+static const char *column_name(int column) {
+  return (column < POLICY_END - 1) ? policy_name[column + 1]
+                                   : profiles[column - POLICY_END + 1].name;
+}
+
+static void print_outcome(const char *name, const outcome_t *outcome,
+                          double operations) {
+  printf(" %s=%.1f%%/%.1f%%/%.3g", name,
+         operations ? 100 * outcome->changed / operations : 0.,
+         operations ? 100 * outcome->zeroed / operations : 0.,
+         outcome->max_change);
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: checkdenormal-whatif [-j JOBS] [-s SEED] FILE...\n"
+          "Re-evaluate the operands recorded with --record=FILE under every\n"
+          "flush policy and platform profile.\n"
+          "  -j JOBS  sites evaluated in parallel (default: online CPUs)\n"
+          "  -s SEED  seed of the stochastic policy (default 1)\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  uint64_t seed = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:s:h")) != -1) {
+    switch (opt) {
+    case 'j':
+      jobs = strtol(optarg, NULL, 10);
+      break;
+    case 's':
+      seed = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind == argc || jobs <= 0) {
+    usage();
+  }
+
+  std::vector<site_t> sites;
+  std::map<std::string, size_t> index;
+  for (int i = optind; i < argc; i++) {
+    read_records(argv[i], sites, index);
+  }
+
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (long j = 0; j < std::min<long>(jobs, (long)sites.size()); j++) {
+    workers.emplace_back([&]() {
+      for (size_t k = next++; k < sites.size(); k = next++) {
+        process_site(&sites[k], seed);
+      }
+    });
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+
+  std::sort(sites.begin(), sites.end(), [](const site_t &x, const site_t &y) {
+    return x.operations > y.operations;
+  });
+  printf("# per site and policy: changed%%/zeroed%%/largest change of the "
+         "results of the recorded operations, relative to gradual "
+         "underflow\n");
+  printf("# policies:");
+  for (int column = 0; column < NB_COLUMNS; column++) {
+    printf(" %s", column_name(column));
+  }
+  printf("\n");
+  outcome_t totals[NB_COLUMNS] = {};
+  double operations = 0;
+  for (const site_t &site : sites) {
+    printf("whatif %s %s_%s samples=%zu operations=%.0f", site.name.c_str(),
+           op_name[site.op], type_name[site.type], site.a.size(),
+           site.operations);
+    for (int column = 0; column < NB_COLUMNS; column++) {
+      print_outcome(column_name(column), &site.outcomes[column],
+                    site.operations);
+      totals[column].changed += site.outcomes[column].changed;
+      totals[column].zeroed += site.outcomes[column].zeroed;
+      totals[column].max_change = std::max(totals[column].max_change,
+                                           site.outcomes[column].max_change);
+    }
+    operations += site.operations;
+    printf("\n");
+  }
+  printf("whatif total sites=%zu operations=%.0f", sites.size(), operations);
+  for (int column = 0; column < NB_COLUMNS; column++) {
+    print_outcome(column_name(column), &totals[column], operations);
+  }
+  printf("\n");
+  return EXIT_SUCCESS;
+}